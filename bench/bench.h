@@ -0,0 +1,37 @@
+/*
+ * Shared helpers of the benchmark drivers in this directory.  The drivers
+ * are built against the same memlib.c and mm.h as the allocator itself;
+ * each file names its own build line.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mmx.h"
+
+/* Returns a monotonic time stamp in nanoseconds. */
+static inline uint64_t benchNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Creates the simulated heap and an empty allocator, or exits. */
+static inline void benchInit(void)
+{
+    mem_init();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+}
+
+#endif /* BENCH_H */
@@ -0,0 +1,92 @@
+/*
+ * Worst-case latency of mm_malloc and mm_free.  A set of 4096 slots is
+ * churned at random, each op freeing a slot's block or allocating 16 to
+ * 1024 bytes into it, and every op is timed on its own.  The latencies go
+ * into power-of-two buckets, so the tail and the maximum are reported
+ * over any number of ops, not only the mean.
+ *
+ * Usage: bench-latency [ops] [rt]
+ *   ops  number of timed ops, 100 million by default; billions work
+ *   rt   run on a 16 MB real-time heap (mm_set_realtime), which needs
+ *        RLIMIT_MEMLOCK to cover it
+ *
+ * Build from the top directory:
+ *   cc -O2 -pthread -I. bench/latency.c mm.c memlib.c -o bench-latency
+ */
+#include <string.h>
+
+#include "bench.h"
+
+#define SLOTS   4096
+#define BUCKETS 64
+#define RT_HEAP (16 << 20)
+
+static uint64_t hist[2][BUCKETS];       /* malloc, free: ops by log2 ns */
+static uint64_t worst[2], total[2], count[2];
+
+/* Files latency "ns" of an op of kind "k". */
+static void record(int k, uint64_t ns)
+{
+    hist[k][ns == 0 ? 0 : 64 - __builtin_clzll(ns)]++;
+    worst[k] = ns > worst[k] ? ns : worst[k];
+    total[k] += ns;
+    count[k]++;
+}
+
+/* Returns the upper bound of the bucket holding quantile "q" of kind "k". */
+static uint64_t quantile(int k, double q)
+{
+    uint64_t seen = 0, want = (uint64_t)(q * count[k]);
+    int b;
+
+    for (b = 0; b < BUCKETS - 1; b++)
+        if ((seen += hist[k][b]) > want)
+            break;
+    return (uint64_t)1 << b;
+}
+
+int main(int argc, char **argv)
+{
+    static void *slot[SLOTS];
+    static const char *name[2] = {"malloc", "free"};
+    uint64_t ops = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000000;
+    uint64_t i, t, seed = 1;
+    int rt = argc > 2 && strcmp(argv[2], "rt") == 0, k;
+    size_t s;
+
+    if (rt)
+        mm_set_realtime(RT_HEAP);
+    benchInit();
+
+    for (i = 0; i < ops; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        s = (seed >> 33) % SLOTS;
+        if (slot[s] != NULL) {
+            t = benchNow();
+            mm_free(slot[s]);
+            record(1, benchNow() - t);
+            slot[s] = NULL;
+        }
+        else {
+            t = benchNow();
+            slot[s] = mm_malloc(16 + (seed >> 20) % 1009);
+            record(0, benchNow() - t);
+            if (slot[s] == NULL) {
+                fprintf(stderr, "out of memory after %llu ops\n",
+                    (unsigned long long)i);
+                return 1;
+            }
+        }
+    }
+
+    printf("%s heap, %llu ops\n", rt ? "real-time" : "ordinary",
+        (unsigned long long)ops);
+    for (k = 0; k < 2; k++)
+        printf("  %-6s mean %6.1f ns  p99 <%6llu ns  p99.99 <%6llu ns  "
+            "max %8llu ns\n", name[k], (double)total[k] / count[k],
+            (unsigned long long)quantile(k, 0.99),
+            (unsigned long long)quantile(k, 0.9999),
+            (unsigned long long)worst[k]);
+    mem_deinit();
+    return 0;
+}
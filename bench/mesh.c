@@ -0,0 +1,84 @@
+/*
+ * Mesh heap colouring and folding.
+ *
+ * Colouring: 1024 pages of 896-byte blocks are allocated from the mesh
+ * heap, and the first block of every page is read over and over.  The same
+ * pages are then read at offset 0, where every page would start without
+ * colouring and every line falls into one cache set.
+ *
+ * Folding: 1200 blocks of 320 bytes, 100 pages in five colours, are
+ * allocated, five in six are freed at random, and mm_mesh is timed and
+ * its released pages counted.  Pages of every colour take part.
+ *
+ * Build from the top directory:
+ *   cc -O2 -pthread -I. bench/mesh.c mm.c memlib.c -o bench-mesh
+ */
+#include <stdint.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define PAGES   1024
+#define ROUNDS  2000
+#define BLOCKS  1200
+
+static volatile long sink;
+
+/* Returns the time per read of walking "line" ROUNDS times. */
+static double walk(volatile char **line, size_t n)
+{
+    uint64_t t = benchNow();
+    size_t r, i;
+    long sum = 0;
+
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < n; i++)
+            sum += *line[i];
+    t = benchNow() - t;
+    sink = sum;
+    return (double)t / ((double)ROUNDS * n);
+}
+
+int main(void)
+{
+    static volatile char *first[PAGES], *base[PAGES];
+    static void *block[BLOCKS];
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE), last = 0;
+    size_t n = 0, colours = 0, released;
+    uint64_t t;
+    char *p;
+    int i;
+
+    benchInit();
+    mm_set_mesh(1);
+
+    /* A block on a new page is that page's first slot. */
+    while (n < PAGES && (p = mm_malloc(800)) != NULL) {
+        if (((uintptr_t)p & ~(page - 1)) != last) {
+            last = (uintptr_t)p & ~(page - 1);
+            first[n] = p;
+            base[n++] = (char *)last;
+            colours += ((uintptr_t)p & (page - 1)) != 0;
+        }
+    }
+    printf("colouring: %zu pages, %zu off offset 0\n", n, colours);
+    printf("  coloured first slots: %6.2f ns/read\n", walk(first, n));
+    printf("  offset 0 of the same: %6.2f ns/read\n", walk(base, n));
+
+    srand(1);
+    for (i = 0; i < BLOCKS; i++)
+        block[i] = mm_malloc(320);
+    for (i = 0; i < BLOCKS; i++)
+        if (rand() % 6 != 0) {
+            mm_free(block[i]);
+            block[i] = NULL;
+        }
+    t = benchNow();
+    released = mm_mesh();
+    t = benchNow() - t;
+    printf("folding: %zu pages released in %.2f ms\n", released,
+        (double)t / 1e6);
+
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Cache-line contention: each of 4 threads bumps a 48-byte counter block
+ * of its own 50 million times.  The counters are allocated either back to
+ * back by the main thread and handed out, as a work queue would, or by
+ * each thread itself; each way is run with and without MM_NOSHARE.
+ * Plain blocks of different threads share lines and the run slows with
+ * the line bouncing between cores; MM_NOSHARE blocks do not.
+ *
+ * Build from the top directory:
+ *   cc -O2 -pthread -I. bench/noshare.c mm.c memlib.c -o bench-noshare
+ */
+#include <pthread.h>
+#include <stdint.h>
+
+#include "bench.h"
+
+#define THREADS 4
+#define BUMPS   50000000L
+#define COUNTER 48
+
+static int flags;                       /* mm_mallocx flags of a counter */
+static volatile long *counter[THREADS];
+
+/* Bumps counter "arg", allocating it first if it was not handed one. */
+static void *bump(void *arg)
+{
+    long t = (long)arg, i;
+    volatile long *c;
+
+    if (counter[t] == NULL)
+        counter[t] = mm_mallocx(COUNTER, flags);
+    c = counter[t];
+    for (i = 0; i < BUMPS; i++)
+        (*c)++;
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t tid[THREADS];
+    uint64_t t;
+    long i;
+    int own, ns;
+
+    benchInit();
+    mm_free_async(mm_malloc(1));        /* serialize the entry points */
+    for (own = 0; own < 2; own++)
+        for (ns = 0; ns < 2; ns++) {
+            flags = ns ? MM_NOSHARE : 0;
+            for (i = 0; i < THREADS; i++)
+                counter[i] = own ? NULL : mm_mallocx(COUNTER, flags);
+
+            t = benchNow();
+            for (i = 0; i < THREADS; i++)
+                pthread_create(&tid[i], NULL, bump, (void *)i);
+            for (i = 0; i < THREADS; i++)
+                pthread_join(tid[i], NULL);
+            t = benchNow() - t;
+
+            printf("%-13s %-10s %7.2f ns/bump, counters %p..%p\n",
+                own ? "per-thread," : "handed out,",
+                ns ? "MM_NOSHARE" : "plain", (double)t / BUMPS,
+                (void *)counter[0], (void *)counter[THREADS - 1]);
+            for (i = 0; i < THREADS; i++)
+                mm_free((void *)counter[i]);
+        }
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Free quarantine, on two workloads, each run with rings of 0, 64, 256
+ * and 1024 blocks:
+ *
+ *   churn     a random mix of mm_malloc and mm_free over 4096 live
+ *             slots.  Frees rarely have a free neighbour here, so the
+ *             ring only adds its bookkeeping and holds memory back; this
+ *             is why the quarantine is off unless mm_set_quarantine
+ *             turns it on.
+ *   teardown  4096 blocks allocated one after another and freed in the
+ *             same order, under critical memory pressure, where free
+ *             purges every block that spans a page.  Without the ring
+ *             each free grows the free run and purges it again; a batch
+ *             merges the run first and purges it once.
+ *
+ * Reports the time per operation and the heap size of each run.
+ *
+ * Build from the top directory:
+ *   cc -O2 -pthread -I. bench/quarantine.c mm.c memlib.c -o bench-quarantine
+ */
+#include "bench.h"
+
+#define SLOTS   4096
+#define OPS     1000000
+#define ROUNDS  100
+
+/* Reports critical pressure, as a cgroup at its limit would. */
+static int critical(struct mm_pressure_sample *ps, void *ctx)
+{
+    (void)ctx;
+    ps->some_avg10 = 0.0;
+    ps->limit = ps->current = 1;
+    return 0;
+}
+
+/* Returns the ns per op of "OPS" random mallocs and frees. */
+static double churn(void)
+{
+    static void *slot[SLOTS];
+    uint64_t t;
+    int i, k;
+
+    srand(1);
+    for (i = 0; i < SLOTS; i++)
+        slot[i] = NULL;
+    t = benchNow();
+    for (k = 0; k < OPS; k++) {
+        i = rand() % SLOTS;
+        if (slot[i] != NULL) {
+            mm_free(slot[i]);
+            slot[i] = NULL;
+        }
+        else
+            slot[i] = mm_malloc(1 + rand() % 256);
+    }
+    return (double)(benchNow() - t) / OPS;
+}
+
+/* Returns the ns per op of "ROUNDS" in-order teardowns of "SLOTS" blocks. */
+static double teardown(void)
+{
+    static void *slot[SLOTS];
+    uint64_t t;
+    int i, k;
+
+    mm_set_pressure_source(critical, NULL);
+    mm_pressure_poll();
+    t = benchNow();
+    for (k = 0; k < ROUNDS; k++) {
+        for (i = 0; i < SLOTS; i++)
+            slot[i] = mm_malloc(64 + i % 4 * 32);
+        for (i = 0; i < SLOTS; i++)
+            mm_free(slot[i]);
+    }
+    t = benchNow() - t;
+    mm_set_pressure_source(NULL, NULL);
+    return (double)t / (2.0 * ROUNDS * SLOTS);
+}
+
+int main(void)
+{
+    static const size_t rings[] = { 0, 64, 256, 1024 };
+    static const char *name[2] = { "churn", "teardown" };
+    double ns;
+    size_t r;
+    int w;
+
+    for (w = 0; w < 2; w++)
+        for (r = 0; r < sizeof(rings) / sizeof(rings[0]); r++) {
+            benchInit();
+            mm_set_quarantine(rings[r]);
+            ns = w == 0 ? churn() : teardown();
+            printf("%-8s ring %4zu: %7.1f ns/op, heap %zu bytes\n", name[w],
+                rings[r], ns, mem_heapsize());
+            mm_flush_quarantine();
+            mem_deinit();
+        }
+    return 0;
+}
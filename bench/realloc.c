@@ -0,0 +1,57 @@
+/*
+ * Append workload for mm_realloc: 8 buffers grown by 1 to 24 bytes at a
+ * time, round robin, with a small allocation between growths so that a
+ * buffer's neighbour is rarely free.  Run once without the geometric
+ * headroom of repeatedly grown blocks, as a baseline, and once with it.
+ * Reports in-place growths, copies and the final heap size of each run.
+ *
+ * Build from the top directory:
+ *   cc -O2 -pthread -I. bench/realloc.c mm.c memlib.c -o bench-realloc
+ */
+#include <string.h>
+
+#include "bench.h"
+
+#define BUFFERS 8
+#define GROWTHS 4000
+
+int main(void)
+{
+    char *buf[BUFFERS];
+    size_t len[BUFFERS], n;
+    struct mm_stats st;
+    uint64_t t;
+    int headroom, i, k;
+
+    for (headroom = 0; headroom < 2; headroom++) {
+        benchInit();
+        mm_set_realloc_headroom(headroom);
+        srand(1);
+        for (i = 0; i < BUFFERS; i++) {
+            buf[i] = mm_malloc(8);
+            len[i] = 8;
+            memset(buf[i], i, 8);
+        }
+
+        t = benchNow();
+        for (k = 0; k < GROWTHS; k++) {
+            i = k % BUFFERS;
+            n = len[i] + 1 + rand() % 24;
+            if ((buf[i] = mm_realloc(buf[i], n)) == NULL) {
+                fprintf(stderr, "mm_realloc failed\n");
+                return 1;
+            }
+            memset(buf[i] + len[i], i, n - len[i]);
+            len[i] = n;
+            mm_malloc(1 + rand() % 64);
+        }
+        t = benchNow() - t;
+
+        mm_get_stats(&st);
+        printf("headroom %-3s: in place %zu, copies %zu, heap %zu bytes, "
+            "%.1f us\n", headroom ? "on" : "off", st.realloc_inplace,
+            st.realloc_copies, mem_heapsize(), t / 1e3);
+        mem_deinit();
+    }
+    return 0;
+}
@@ -13,13 +13,25 @@
  * as a pointer, i.e., sizeof(uintptr_t) == sizeof(void *).
  */
 
+#define _GNU_SOURCE         /* memfd_create and fallocate hole punching */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "mmx.h"
+
 team_t team = {
     /* Team name */
     "April Coders"    ,
@@ -47,6 +59,17 @@ team_t team = {
 #define MINIMUM    6 * WSIZE  /* minimum block size */
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+/* Fields of the mm_mallocx flags word */
+#define FLAG_LG_ALIGN(f)  ((f) & 0x3f)
+#define FLAG_ARENA(f)     (((f) >> 16) & 0xf)
+#define ARENAS      16       /* arenas that MM_ARENA may name */
+#define ARENA_SLOP  65536    /* bytes a thread charges before publishing */
+#define FLAG_HEAP   0x8000   /* internal: split from the heap proper */
+#define CACHELINE   64       /* unit of MM_NOSHARE blocks */
+#define NS_REGION   4        /* pages of a thread's MM_NOSHARE region */
+#define NS_MAX      1024     /* largest size carved from such a region */
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
@@ -55,9 +78,24 @@ team_t team = {
 #define GET(p)       (*(int *)(p))
 #define PUT(p, val)  (*(int *)(p) = (val))
 
+/*
+ * The top bits of an allocated block's header carry its arena, so such a
+ * block is smaller than HEAP_BLOCK_MAX; a free block uses every bit.
+ */
+#define ARENA_SHIFT 28
+#define ARENA_MASK  ((int)((ARENAS - 1u) << ARENA_SHIFT))
+#define HEAP_BLOCK_MAX ((size_t)1 << ARENA_SHIFT)
+
 /* Read the size and allocated fields from address p */
-#define GET_SIZE(p)  (GET(p) & ~0x7)
+#define GET_SIZE(p)  (GET(p) & ~(GET_ALLOC(p) ? ARENA_MASK | 0x7 : 0x7))
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_RELOC(p) (GET(p) & 0x2)  /* block belongs to a handle */
+#define GET_NOSHARE(p) (GET(p) & 0x4)  /* block owns its cache lines */
+
+/* Read and write the arena tag of an allocated block's header */
+#define GET_ARENA(p)     ((int)((unsigned)GET(p) >> ARENA_SHIFT))
+#define PUT_ARENA(p, a)  PUT(p, (GET(p) & ~ARENA_MASK) | \
+                             (int)((unsigned)(a) << ARENA_SHIFT))
 
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((void *)(bp) - WSIZE)
@@ -67,24 +105,647 @@ team_t team = {
 #define NEXT_BLKP(bp)  ((void *)(bp) + GET_SIZE(HDRP(bp)))
 #define PREV_BLKP(bp)  ((void *)(bp) - GET_SIZE(HDRP(bp) - WSIZE))
 
+/* Size class of a free block: the index of the highest bit of its size */
+#define CLASSES        (8 * sizeof(size_t))
+#define SIZE_CLASS(sz) (CLASSES - 1 - __builtin_clzl(sz))
+
+/* Address of the first block after the prologue */
+#define FIRST_BLKP     ((void *)heap_listp + DSIZE + MINIMUM)
+
 /* Given block ptr bp, compute address of next and previous free blocks */
 #define NEXT_FREEP(bp)(*(void **)(bp + DSIZE))
 #define PREV_FREEP(bp)(*(void **)(bp))
 
+/* Lifetime prediction constants */
+#define LT_SITES    256      /* allocation sites remembered */
+#define LT_TRACKED  4096     /* live blocks sampled at once (power of 2) */
+#define LT_SHORT    1024     /* lifetime (in allocations) considered short */
+#define LT_WARMUP   8        /* samples before a site's average is trusted */
+#define LT_REGION   16       /* pages in a short-lived region */
+#define LT_REGION_MAX 2048   /* largest block carved from one */
+
+/* Average lifetime learned for one allocation site */
+struct ltsite {
+    uintptr_t site;          /* hashed call site or caller hint */
+    long avg;                /* running average lifetime */
+    unsigned samples;        /* number of lifetimes folded into avg */
+    uint16_t gen;            /* bumped whenever another site claims it */
+};
+
+/* A sampled live block: heap offset, owning site and birth time */
+struct ltblock {
+    uint32_t off;            /* offset from heap_listp, 0 if slot empty */
+    uint16_t site;           /* index into lt_sites */
+    uint16_t gen;            /* that site's generation at the birth */
+    size_t birth;            /* lt_clock at allocation */
+};
+
+/* Realloc growth tracking constants */
+#define GROWERS     64       /* recently grown blocks remembered */
+#define GROW_REPEAT 2        /* growths before headroom is reserved */
+#define GROWER(bp)  (&growers[(((char *)(bp) - heap_listp) >> 3) % GROWERS])
+
+/* Heap anchor constants */
+#define EXTENT_SHIFT 16      /* anchors are kept per 64 KB extent */
+#define ANCHORS     65536    /* extents covered: all 4 GB of heap offsets */
+#define ANCHOR_EXTENT(off) (((off) - WSIZE) >> EXTENT_SHIFT)
+#define WALKERS     64       /* most threads in a parallel walk */
+
+/* Guard-page debug mode constants */
+#define GUARD_ENV   "MM_GUARD"   /* environment variable enabling the mode */
+#define GUARD_QUARANTINE 64      /* freed guarded mappings held back */
+
+/* Free quarantine constants */
+#define QUARANTINE_MAX 1024  /* largest configurable ring */
+#define POISON      0xdb     /* fills quarantined payloads in DEBUG builds */
+
+/* Deferred free constants */
+#define EPOCH_THREADS 64     /* threads that may use epochs at once */
+#define EPOCH_BATCH 64       /* retirements between attempts to advance */
+#define EPOCH_SPILL 1024     /* blocks per bag chunk, freed as one batch */
+
+/* Asynchronous free constants */
+#define ASYNC_BATCH 1024     /* frees a thread buffers before handing off */
+
+/* Serialize an entry point with other threads, background ones included */
+#define HEAP_LOCK()   pthread_mutex_lock(&heap_lock)
+#define HEAP_UNLOCK() pthread_mutex_unlock(&heap_lock)
+
+/* Growth-ahead constants */
+#define GROW_HORIZON 4       /* intervals of demand kept in the wilderness */
+#define GROW_MIN    (16 * (CHUNKSIZE))  /* smallest step ahead */
+#define GROW_MAX    (1 << 26)           /* largest step ahead */
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23          /* Linux 5.14 */
+#endif
+
+/* Real-time mode constants */
+#define RT_PROBES   16       /* free blocks a real-time search examines */
+
+/* Memory pressure constants */
+#define PSI_PATH    "/proc/pressure/memory"
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+/* Buddy backend constants */
+#define BUDDY_ORDERS 13      /* most orders between the range and the zone */
+#define BUDDY_ZONE  2        /* a zone holds 1 << BUDDY_ZONE top blocks... */
+#define BUDDY_ZONE_MIN 16    /* ...and at least 64 KB where the orders allow */
+#define BUDDY_WORDS ((1 << BUDDY_ORDERS) / 64)
+
+/* Page heap constants */
+#define REGION_PAGES 64      /* smallest region carved from the heap */
+#define SPAN_BINS   32       /* free span bins; the last holds larger spans */
+#define SPAN_FREE   0        /* span states */
+#define SPAN_LARGE  1
+#define SPAN_OOB    2
+#define SPAN_SHORT  3
+#define SPAN_NOSHARE 4
+
+/* Large mapping constants */
+#define LMAP_HDR    64       /* header in front of a mapping's payload */
+#define LMAP_MAX    64       /* most mappings retained at once */
+#define LMAP_SPLIT  (1 << 16)   /* smallest remainder split off for reuse */
+#define PM_LMAP     0x1      /* pagemap owner tag of a large mapping */
+#define PM_BUDDY    0x2      /* pagemap owner tag of a buddy zone */
+
+/* Pagemap constants: three levels of 12 bits over 4 KB pages of 48 bits */
+#define PM_SHIFT    12       /* page size of the pagemap */
+#define PM_BITS     12       /* bits of page number per level */
+#define PM_SIZE     (1 << PM_BITS)
+
+/* Mesh heap constants */
+#define MESH_PAGES  4096     /* virtual pages of the mesh heap */
+#define MESH_ALIAS  8        /* most virtual pages sharing a physical one */
+#define MESH_NONE   UINT32_MAX
+#define MESH_MAX    1024     /* largest size served from mesh pages */
+#define MESH_CLASSES 20
+#define MESH_SLOTS(c) MIN(mem_pagesize() / mesh_sizes[c], (size_t)256)
+#define MESH_GRAIN  16       /* bytes per bit of a page's occupancy map */
+#define MESH_GWORDS (mem_pagesize() / MESH_GRAIN / 64)
+#define MESH_GRAINS(p) (mesh_grains + (size_t)(p) * MESH_GWORDS)
+
+/* Out-of-band metadata constants */
+#define OOB_GRAIN   16       /* bytes per granule of a dense span */
+#define OOB_PAGES   64       /* pages per dense span */
+#define OOB_MAX     65536    /* largest size served from dense spans */
+
+/* Handle table constants */
+#define HCHUNK      256      /* handles added to the table at a time */
+
+/*
+ * A handle's master pointer.  The handle given to the client is the
+ * address of "ptr"; a handle block keeps the address of its entry in its
+ * first payload word so that the compactor can update "ptr".
+ */
+struct hentry {
+    void *ptr;               /* current payload address */
+    unsigned locks;          /* nonzero while the client pins the block */
+    struct hentry *next;     /* next unused entry */
+};
+
+/*
+ * A span: a run of pages of one region.  Each region's header has one
+ * descriptor per page; the descriptor of a span's first page is the span,
+ * and the one of its last page records "first" so that the left
+ * neighbour of a span can be found when it is freed.
+ */
+struct span {
+    uint32_t first;          /* index of the first page in the region */
+    uint32_t npages;         /* length in pages */
+    uint8_t state;           /* SPAN_FREE or the user's kind */
+    bool purged;             /* pages given back with madvise */
+    bool carving;            /* SPAN_NOSHARE: a thread's current region */
+    struct span *next;       /* free span bin links */
+    struct span *prev;
+    struct region *region;
+    struct oobmeta *meta;    /* SPAN_OOB: its metadata */
+    uint32_t live;           /* SPAN_SHORT, SPAN_NOSHARE: blocks not freed */
+    uint32_t bump;           /* SPAN_SHORT, SPAN_NOSHARE: bytes carved */
+};
+
+/*
+ * Metadata of a dense span, kept in a heap block of its own.  A block is
+ * a run of allocated granules whose first granule has its start bit set;
+ * payloads are packed with no headers between them.  Spans with free
+ * granules are linked through their metadata.
+ */
+struct oobmeta {
+    char *base;              /* first granule */
+    struct span *span;
+    uint32_t ngrain;         /* granules in the span */
+    uint32_t nfree;          /* free granules */
+    struct oobmeta *next;    /* spans with free granules */
+    struct oobmeta *prev;
+    uint64_t alloc[];        /* ngrain allocated bits, then ngrain start bits */
+};
+
+/* A page-aligned run of the heap that the page heap carves spans from */
+struct region {
+    char *base;              /* first page */
+    uint32_t npages;         /* pages, including the header pages */
+    uint32_t hdrpages;       /* pages holding this header */
+    struct region *next;     /* all regions */
+    struct span spans[];     /* one descriptor per page */
+};
+
+/*
+ * The start of a guarded mapping, which is on the live list until freed.
+ */
+struct gmap {
+    struct gmap *next;
+    struct gmap *prev;
+    size_t len;              /* bytes mapped, guard page included */
+    char *bp;                /* payload */
+};
+
+/*
+ * A mapping of its own for one large block, kept in front of the payload.
+ * A live mapping is on the live list and recorded in the pagemap at its
+ * first page.  A retained one is in the bin of its size class and on the
+ * age list, and recorded at its first and last pages, so that retained
+ * neighbours find each other and merge.
+ */
+struct lmap {
+    size_t len;              /* bytes mapped, header included */
+    bool retained;           /* free and kept for reuse */
+    uint64_t released;       /* when it was retained, in ms */
+    struct lmap *next;       /* bin, or live list */
+    struct lmap *prev;
+    struct lmap *newer;      /* age list, retained only */
+    struct lmap *older;
+};
+
+/* Pagemap levels below the root; leaves hold the owner of each page */
+struct pmleaf {
+    void *owner[PM_SIZE];
+};
+
+struct pmnode {
+    struct pmleaf *leaf[PM_SIZE];
+};
+
+/*
+ * A physical page of the mesh heap, named by its page number in the
+ * memfd.  It holds objects of one size class and is mapped at one or more
+ * virtual pages that all see the same objects.  Its own slots start at a
+ * colour offset, a whole number of cache lines within the slack the slots
+ * leave, so that the first slots of the pages of a class fall into
+ * different cache sets.  Pages of different colours may still be folded
+ * together, so a page can also hold objects off its own slot grid; the
+ * page's occupancy map (MESH_GRAINS) records every live byte, and "used"
+ * marks the own slots that are allocated or overlapped by such objects.
+ */
+struct mpage {
+    uint64_t used[4];        /* own slots not available */
+    uint16_t sclass;         /* index into mesh_sizes */
+    uint16_t nfree;          /* own slots available */
+    uint16_t nlive;          /* objects on the page */
+    uint16_t nalias;         /* virtual pages mapping this page */
+    uint16_t color;          /* offset of the first slot */
+    uint32_t alias[MESH_ALIAS];
+    struct mpage *next;      /* partially used pages of the class */
+    struct mpage *prev;
+};
+
+/*
+ * A chunk of a bag of retired blocks.  The blocks themselves are left
+ * untouched, since readers may still be using them.
+ */
+struct echunk {
+    struct echunk *next;     /* older chunks of the bag, or spare chunks */
+    uint64_t epoch;          /* orphaned chunks: the epoch of their bag */
+    size_t n;
+    void *v[EPOCH_SPILL];
+};
+
+/*
+ * A thread's epoch record.  "epoch" is the global epoch it observed on
+ * entry, or 0 outside of any epoch.  Blocks it retires wait in one of
+ * three bags, by the epoch they were retired in.  An exiting thread hands
+ * its bags to the orphans, which any thread releases once their epoch
+ * has passed.
+ */
+struct ethread {
+    uint64_t epoch;
+    int claimed;
+    int depth;               /* nesting of mm_epoch_enter */
+    uint64_t bag_epoch[3];
+    struct echunk *bag[3];
+    size_t nbag[3];
+};
+
+/* A buffer of mm_free_async calls, filled by one thread at a time */
+struct abatch {
+    struct abatch *next;     /* queued or spare buffers */
+    unsigned generation;     /* heap_generation when first filled */
+    size_t n;
+    void *v[ASYNC_BATCH];
+};
+
+/* A block that mm_realloc has grown and how often */
+struct grower {
+    void *bp;
+    unsigned grows;
+};
+
 /* Global variables: */
+char *mm_compress_base = 0;   /* Origin of compressed references */
 static char *heap_listp = 0;  /* Pointer to the first block */
 static char *free_listp = 0; /* Pointer to the first free block */
 
+static bool lifetime_mode = false;      /* segregate short-lived blocks */
+static size_t lt_clock = 0;             /* allocations since mm_init */
+static size_t lt_live = 0;              /* occupied lt_blocks slots */
+static struct span *lt_region = NULL;   /* short-lived region being carved */
+static struct ltsite lt_sites[LT_SITES];
+static struct ltblock lt_blocks[LT_TRACKED];
+
+static struct grower growers[GROWERS];  /* direct-mapped by address */
+static bool realloc_headroom = true;    /* growing blocks earn headroom */
+static size_t realloc_inplace = 0;      /* reallocs grown in place */
+static size_t realloc_copies = 0;       /* reallocs that moved the block */
+static size_t heap_grown = 0;           /* bytes extendHeap added */
+static size_t heap_grown_ahead = 0;     /* of which by the grow-ahead thread */
+
+static struct hentry *free_handles = 0; /* unused handle table entries */
+
+/*
+ * For each extent of the heap, the offset from heap_listp of the first
+ * block whose header lies in the extent, or 0 if none does.  Lets the heap
+ * be split into extents that are walked independently.
+ */
+static uint32_t anchors[ANCHORS];
+
+/*
+ * Guard-page debug mode.  Freed guarded mappings are made inaccessible and
+ * kept in a FIFO ring before being unmapped, so late accesses fault.
+ */
+static bool guard_mode = false;
+static struct gmap *guard_live = NULL;
+static struct {
+    void *base;
+    size_t len;
+} guard_ring[GUARD_QUARANTINE];
+static size_t guard_next = 0;           /* oldest entry of guard_ring */
+
+/*
+ * Buddy backend.  Power-of-two blocks in [1 << buddy_min, 1 << buddy_max]
+ * are carved from zones of 1 << buddy_top bytes, each an aligned block of
+ * the heap with its struct bzone right after it.  Each order has a bitmap
+ * of its free blocks; the bitmaps are packed into the zone's free words
+ * starting at buddy_base[order].  Blocks carry no header or footer; the
+ * order of each allocated block is kept in the zone's order table,
+ * indexed by its offset in units of the smallest block.  The pagemap maps
+ * a zone's pages to its bzone, tagged with PM_BUDDY.
+ */
+struct bzone {
+    char *base;              /* first byte of the zone */
+    struct bzone *next;      /* zones, most recently freed into first */
+    struct bzone *prev;
+    uint64_t free[BUDDY_WORDS];
+    unsigned char order[1 << (BUDDY_ORDERS - 1)];
+};
+
+static struct bzone *buddy_zones = NULL;
+static int buddy_min = 0, buddy_max = 0, buddy_top = 0;
+static size_t buddy_base[BUDDY_ORDERS];
+
+/*
+ * Page heap: regions, bins of free spans by length, and the size from
+ * which allocations are served as spans of their own.
+ */
+static struct region *regions = NULL;
+static struct span *span_bins[SPAN_BINS];
+static size_t span_threshold = 0;       /* 0 = large spans off */
+
+/* Large mappings: blocks mapped on their own, retained a while after free */
+static struct lmap *lmap_live = NULL;
+static struct lmap *lmap_bins[CLASSES]; /* retained, by size class */
+static struct lmap *lmap_oldest = NULL; /* ends of the age list */
+static struct lmap *lmap_newest = NULL;
+static size_t lmap_threshold = 0;       /* 0 = large mappings off */
+static size_t lmap_retain = 0;          /* most bytes retained */
+static size_t lmap_bytes = 0;           /* bytes retained */
+static int lmap_count = 0;              /* mappings retained */
+static size_t lmap_hits = 0;
+static size_t lmap_misses = 0;
+
+/*
+ * Pagemap: maps each page of an allocated span to its descriptor, so that
+ * any address inside a span finds its owner without touching the memory
+ * next to it.  Nodes are mapped lazily and never freed; readers need no
+ * lock.
+ */
+static struct pmnode *pagemap[PM_SIZE];
+
+static bool noshare_mode = false;       /* every block owns its lines */
+
+/*
+ * Each thread carves its small MM_NOSHARE blocks from a region of its own,
+ * so that the lines it writes are ones no other thread was handed.
+ */
+static pthread_key_t noshare_key;
+static pthread_once_t noshare_once = PTHREAD_ONCE_INIT;
+static __thread struct span *noshare_region = NULL;
+static __thread unsigned noshare_gen = 0;
+static size_t rt_size = 0;              /* real-time heap for mm_init */
+static bool rt_mode = false;            /* the heap is fixed and locked */
+
+/*
+ * Growth ahead of demand.  grow_demand counts the bytes of heap blocks
+ * allocated since the grow-ahead thread last looked.
+ */
+static size_t grow_demand = 0;
+static bool growing_ahead = false;      /* the thread is extending the heap */
+static unsigned grow_ms = 0;            /* 0 = no thread */
+static pthread_t grow_thread;
+static pthread_mutex_t grow_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t grow_wake = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Arena budgets.  arena_live counts the bytes of the heap-proper blocks
+ * of each arena, as published by the threads; each thread keeps its
+ * unpublished charges in arena_delta, stamped with the heap generation.
+ */
+static long arena_live[ARENAS];
+static size_t arena_soft[ARENAS];       /* 0 = no limit */
+static size_t arena_hard[ARENAS];
+static bool arena_over[ARENAS];         /* soft limit handled */
+static mm_pressure_fn arena_fn[ARENAS];
+static void *arena_ctx[ARENAS];
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static pthread_key_t arena_key;
+static __thread long arena_delta[ARENAS];
+static __thread unsigned arena_gen = 0;
+
+/*
+ * Memory pressure.  pressure_level is the level of the last poll, and a
+ * heap block that free leaves at least purge_min bytes long has its
+ * interior purged at once; 0 turns that off.
+ */
+static mm_pressure_src pressure_src = NULL;     /* NULL = the system */
+static void *pressure_ctx = NULL;
+static int pressure_level = MM_PRESSURE_NONE;
+static size_t purge_min = 0;
+static pthread_t pressure_thread;
+static unsigned pressure_ms = 0;                /* 0 = no monitor */
+static pthread_mutex_t pressure_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pressure_wake = PTHREAD_COND_INITIALIZER;
+
+/* Dense spans with out-of-band metadata */
+static size_t oob_max = 0;              /* 0 = off */
+static struct oobmeta *oob_spans = NULL;
+
+/*
+ * Mesh heap: small blocks in single-size pages of a memfd-backed mapping.
+ * mesh_map gives the physical page behind each virtual page.  mm_mesh
+ * folds pairs of pages whose slots do not overlap onto one physical page.
+ */
+static const uint16_t mesh_sizes[MESH_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192,
+    224, 256, 320, 384, 448, 512, 640, 768, 896, 1024
+};
+static bool mesh_mode = false;
+static int mesh_fd = -1;
+static char *mesh_base = NULL;          /* NULL until first used */
+static uint32_t mesh_map[MESH_PAGES];
+static struct mpage mesh_phys[MESH_PAGES];
+static uint64_t *mesh_grains = NULL;    /* occupancy maps, by physical page */
+static struct mpage *mesh_partial[MESH_CLASSES];
+static uint32_t mesh_cursor = 0;        /* next virtual page to try */
+static uint16_t mesh_color[MESH_CLASSES];   /* colour of the next page */
+static size_t mesh_meshed = 0;          /* physical pages released */
+static bool mesh_atfork = false;        /* fork handlers registered */
+
+/*
+ * The heap lock is recursive, since some frees free internal blocks in
+ * turn.  Every entry point takes it, so that a background thread can be
+ * started at any time without racing callers already inside.
+ */
+static pthread_mutex_t heap_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static unsigned heap_generation = 0;    /* mm_init calls so far */
+
+/* Asynchronous free: full buffers queue up for the reclaimer thread */
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t async_idle = PTHREAD_COND_INITIALIZER;
+static struct abatch *async_queue = NULL;
+static struct abatch *async_spare = NULL;
+static size_t async_busy = 0;           /* buffers queued or being freed */
+static bool async_running = false;
+static pthread_once_t async_once = PTHREAD_ONCE_INIT;
+static pthread_key_t async_key;
+static __thread struct abatch *async_self = NULL;
+
+static struct ethread epoch_threads[EPOCH_THREADS];
+static uint64_t epoch_global = 1;
+static __thread struct ethread *epoch_self = NULL;
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t epoch_key;
+static pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct echunk *epoch_orphans = NULL;     /* under epoch_lock */
+static struct echunk *epoch_spare = NULL;       /* under epoch_lock */
+
+/*
+ * Free quarantine: a FIFO ring of freed blocks that stay marked allocated
+ * until they are drained in address-sorted batches.
+ */
+static void *quarantine[QUARANTINE_MAX];
+static size_t quarantine_size = 0;      /* configured capacity, 0 = off */
+static size_t quarantine_head = 0;      /* oldest entry */
+static size_t quarantine_len = 0;       /* entries held */
+
 /* Function prototypes for internal helper routines: */
 static void *extendHeap(size_t words);
 static void place(void *bp, size_t asize);
-static void *findFit(size_t asize);
+static void *placeTail(void *bp, size_t asize);
+static void *findFit(size_t asize, bool lowest);
+static void *alignedFit(size_t asize, size_t align);
 static void *coalesce(void *bp);
+static void *wilderness(void);
+static void *allocate(size_t size, int flags, uintptr_t site);
+static void anchorBlock(void *bp);
+static void anchorDrop(void *bp, void *next);
+static void anchorRebuild(void);
+static bool inHeap(void *bp);
+static void *guardAlloc(size_t size);
+static void guardFree(void *bp);
+static bool isGuarded(void *bp);
+static size_t foreignSize(void *bp);
+static bool freeForeign(void *bp);
+static int buddyOrder(size_t size);
+static void *buddyAlloc(int k);
+static void *buddyTake(struct bzone *z, int k);
+static void buddyFree(struct bzone *z, void *bp);
+static struct bzone *buddyOf(void *bp);
+static int buddyBlock(struct bzone *z, size_t off, bool *used);
+static struct span *spanAlloc(size_t npages, int state);
+static void spanFree(struct span *sp);
+static struct span *spanOf(void *bp);
+static void spanInsert(struct span *sp);
+static void spanRemove(struct span *sp);
+static void spanMark(struct span *sp);
+static void *pagemapGet(void *p);
+static struct span *pagemapSpan(void *p);
+static struct lmap *lmapOf(void *bp);
+static struct lmap *lmapAt(void *p);
+static void *lmapAlloc(size_t size, bool cached);
+static void lmapFree(struct lmap *m);
+static int lmapRetain(struct lmap *m);
+static void lmapForget(struct lmap *m);
+static void lmapUnmap(struct lmap *m);
+static uint64_t lmapClock(void);
+static bool inMesh(void *bp);
+static void *meshAlloc(size_t size);
+static void meshFree(void *bp);
+static void meshRelease(struct mpage *mp);
+static void meshFold(struct mpage *dst, struct mpage *src);
+static void meshLink(struct mpage *mp);
+static void meshForkPrepare(void);
+static void meshForkParent(void);
+static void meshForkChild(void);
+static void *oobAlloc(size_t size);
+static void oobFree(struct oobmeta *om, void *bp);
+static size_t oobSize(struct oobmeta *om, void *bp);
+static size_t oobNext(const uint64_t *map, size_t g, size_t limit, bool set);
+static void oobFill(uint64_t *map, size_t g, size_t n, bool on);
+static void oobLink(struct oobmeta *om);
+static void oobUnlink(struct oobmeta *om);
+static void meshUnlink(struct mpage *mp);
+static uint16_t meshColor(int c);
+static bool meshOverlap(struct mpage *a, struct mpage *b);
+static void *pagemapNode(void **slot, size_t size);
+static int pagemapSet(void *p, size_t len, void *owner);
+static void drainQuarantine(size_t n);
+static void freeBatch(void **v, size_t n);
+static int byAddress(const void *a, const void *b);
+static int initHeap(void);
+static void freeBlock(void *bp);
+static void *reallocate(void *bp, size_t size, uintptr_t site);
+static void freeSorted(void **v, size_t n);
+static void asyncStart(void);
+static void asyncExit(void *arg);
+static void asyncHand(struct abatch *b);
+static void *asyncReclaim(void *arg);
+static void arenaCharge(int a, long n);
+static long arenaUsage(int a);
+static void arenaKey(void);
+static void arenaExit(void *arg);
+static void arenaPurge(int a);
+static size_t purgeFree(void *bp);
+static int pressureRead(struct mm_pressure_sample *ps, void *ctx);
+static size_t pressureFile(const char *dir, const char *name);
+static void *pressureMonitor(void *arg);
+static void *growAhead(void *arg);
+static struct ethread *epochSelf(void);
+static void epochKey(void);
+static void epochExit(void *arg);
+static bool epochAdvance(uint64_t e);
+static void epochRelease(struct ethread *et, int i);
+static void epochOrphans(uint64_t e);
+static void epochFree(struct echunk *c);
+static void *walkExtents(void *arg);
+
+/* Function prototypes for lifetime prediction: */
+static struct ltsite *ltSite(uintptr_t site);
+static struct ltblock *ltSlot(uint32_t off);
+static bool ltPredictShort(uintptr_t site);
+static void ltBirth(void *bp, uintptr_t site);
+static void ltDeath(void *bp);
+static void *ltRegionAlloc(size_t size);
+static void ltRegionFree(struct span *sp, void *bp);
+static void *nsAlloc(size_t size);
+static size_t nsSize(struct span *sp, void *bp);
+static void nsFree(struct span *sp);
+static void nsKey(void);
+static void nsExit(void *arg);
+
+/* An allocated block as seen by the leak checker */
+struct leakent {
+    char *bp;                /* payload address */
+    size_t size;             /* block size */
+    uintptr_t site;          /* allocation site, if sampled */
+    unsigned char mark;      /* LEAK_MARKED once reachable, then SCANNED */
+};
+
+/* Leak checker constants */
+#define LEAK_MARKED  1       /* reachable, payload not yet scanned */
+#define LEAK_SCANNED 2       /* reachable and claimed for scanning */
+#define LEAK_STACK   1024    /* blocks a marking walker holds at once */
+
+/* The candidates of a leak check, shared by its marking walkers */
+struct leakwalk {
+    struct leakent *v;       /* sorted by address */
+    size_t n;
+    int again;               /* a block was left marked but unscanned */
+};
+
+/* Function prototypes for the leak checker: */
+static struct leakent *leakFind(struct leakent *v, size_t n, uintptr_t w);
+static size_t leakMesh(struct leakent *v);
+static size_t leakMaps(struct leakent *v);
+static void leakRoots(struct leakwalk *lw);
+static void leakScan(struct leakwalk *lw, char *lo, char *hi, size_t *stack,
+    size_t *top);
+static void leakDrain(struct leakwalk *lw, struct leakent *e);
+static int leakWalk(const struct mm_block_info *blk, void *ctx);
+static int leakBySize(const void *a, const void *b);
+static int leakBySite(const void *a, const void *b);
+static int leakByAddress(const void *a, const void *b);
+
+/* Totals of a checker walk, added to by several walkers at once */
+struct checkwalk {
+    size_t heapfree;         /* free blocks seen */
+    size_t bytes;            /* bytes of the blocks seen */
+    bool verbose;            /* print each block; the walk is serial */
+};
 
 /* Function prototypes for heap consistency checker routines: */
 static void printblock(void *bp);
 static void checkheap(int verbose);
 static void checkblock(void *bp);
+static int checkWalk(const struct mm_block_info *blk, void *ctx);
+static int walkThreads(void);
 static void add(void *bp);     /* insert in linked list */
 static void delete(void *bp);  /* remove from linked list */
 
@@ -98,8 +759,29 @@ static void delete(void *bp);  /* remove from linked list */
  */
 int mm_init(void)
 {
+    int ret;
+
+    HEAP_LOCK();
+    ret = initHeap();
+    HEAP_UNLOCK();
+    return ret;
+}
+
+/*
+ * Does the work of mm_init.  Buffers of mm_free_async still pending
+ * belong to the old heap and will be dropped.
+ */
+static int initHeap(void)
+{
+    struct echunk *orphans;
+    struct gmap *gm;
+    size_t i;
+    char *bp, *p;
+    int k;
+
+    heap_generation++;
    /* Create the initial empty heap. */
-    if ((heap_listp = mem_sbrk(2*MINIMUM)) == NULL)
+    if ((heap_listp = mem_sbrk(MINIMUM + DSIZE)) == NULL)
         return -1;
 
     PUT(heap_listp, 0);                               //Alignment padding   
@@ -115,9 +797,88 @@ int mm_init(void)
      */
     free_listp = heap_listp + DSIZE;	
 
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes. */
-    if (extendHeap(CHUNKSIZE / WSIZE) == NULL)
+    /*
+     * The heap is one fixed reservation that never moves, so references
+     * relative to its start stay valid until the next mm_init.
+     */
+    mm_compress_base = mem_heap_lo();
+
+    /* Forget lifetimes sampled in the previous heap */
+    lt_clock = 0;
+    lt_live = 0;
+    lt_region = NULL;
+    memset(lt_sites, 0, sizeof(lt_sites));
+    memset(lt_blocks, 0, sizeof(lt_blocks));
+    memset(growers, 0, sizeof(growers));
+    memset(anchors, 0, sizeof(anchors));
+
+    /* Guard pages are switched on from the environment, no rebuild. */
+    for (i = 0; i < GUARD_QUARANTINE; i++) {
+        if (guard_ring[i].base != NULL)
+            munmap(guard_ring[i].base, guard_ring[i].len);
+        guard_ring[i].base = NULL;
+    }
+    guard_mode = getenv(GUARD_ENV) != NULL && strcmp(getenv(GUARD_ENV), "0");
+    quarantine_head = quarantine_len = 0;
+    for (i = 0; i < EPOCH_THREADS; i++) {
+        for (k = 0; k < 3; k++) {
+            epochFree(epoch_threads[i].bag[k]);
+            epoch_threads[i].bag[k] = NULL;
+        }
+        memset(epoch_threads[i].nbag, 0, sizeof(epoch_threads[i].nbag));
+    }
+    pthread_mutex_lock(&epoch_lock);
+    orphans = epoch_orphans;
+    epoch_orphans = NULL;
+    pthread_mutex_unlock(&epoch_lock);
+    epochFree(orphans);
+    for (; buddy_zones != NULL; buddy_zones = buddy_zones->next)
+        pagemapSet(buddy_zones->base, (size_t)1 << buddy_top, NULL);
+    for (; regions != NULL; regions = regions->next)
+        pagemapSet(regions->base, (size_t)regions->npages * mem_pagesize(),
+            NULL);
+    memset(span_bins, 0, sizeof(span_bins));
+    if (mesh_base != NULL) {
+        munmap(mesh_base, (size_t)MESH_PAGES * mem_pagesize());
+        munmap(mesh_grains, MESH_PAGES * MESH_GWORDS * sizeof(uint64_t));
+        close(mesh_fd);
+        mesh_base = NULL;
+    }
+    mesh_meshed = 0;
+    oob_spans = NULL;
+    while (lmap_live != NULL)
+        lmapUnmap(lmap_live);
+    for (; guard_live != NULL; guard_live = gm) {
+        gm = guard_live->next;
+        munmap(guard_live, guard_live->len);
+    }
+    while (lmap_oldest != NULL)
+        lmapUnmap(lmap_oldest);
+    lmap_hits = lmap_misses = 0;
+    for (i = 0; i < ARENAS; i++) {
+        __atomic_store_n(&arena_live[i], 0, __ATOMIC_RELAXED);
+        arena_over[i] = false;
+    }
+    realloc_inplace = realloc_copies = 0;
+    heap_grown = heap_grown_ahead = grow_demand = 0;
+    free_handles = NULL;
+
+    /*
+     * A real-time heap is extended once to its full size, faulted in and
+     * locked; otherwise extend the empty heap with a free block of
+     * CHUNKSIZE bytes.
+     */
+    rt_mode = false;
+    if (rt_size == 0)
+        return extendHeap(CHUNKSIZE / WSIZE) == NULL ? -1 : 0;
+    if ((bp = extendHeap(rt_size / WSIZE)) == NULL)
+        return -1;
+    for (p = (char *)bp + DSIZE + WSIZE; p < (char *)FTRP(bp);
+         p += mem_pagesize())
+        *(volatile char *)p = 0;
+    if (mlock(mem_heap_lo(), mem_heapsize()) != 0)
         return -1;
+    rt_mode = true;
     return 0;
 }
 
@@ -128,33 +889,272 @@ int mm_init(void)
  * Effects:
  *   Allocate a block with at least "size" bytes of payload, unless "size" is
  *   zero.  Returns the address of this block if the allocation was successful
- *   and NULL otherwise.
+ *   and NULL otherwise.  The caller's address identifies the allocation site
+ *   when lifetime-aware placement is on.
  */
 void *mm_malloc(size_t size)
+{
+    void *bp;
+
+    HEAP_LOCK();
+    bp = allocate(size, 0, (uintptr_t)__builtin_return_address(0));
+    HEAP_UNLOCK();
+    return bp;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload, steered by the
+ *   MM_* hints in "flags" (see mmx.h).  mm_malloc(size) is the same as
+ *   mm_mallocx(size, 0).  Returns the address of this block if the
+ *   allocation was successful and NULL otherwise.
+ */
+void *mm_mallocx(size_t size, int flags)
+{
+    void *bp;
+
+    HEAP_LOCK();
+    bp = allocate(size, flags, (uintptr_t)__builtin_return_address(0));
+    HEAP_UNLOCK();
+    return bp;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Like mm_malloc, but "hint" names the allocation site instead of the
+ *   caller's address.  Blocks allocated with the same hint are expected to
+ *   have similar lifetimes.
+ */
+void *mm_malloc_hint(size_t size, uintptr_t hint)
+{
+    void *bp;
+
+    HEAP_LOCK();
+    bp = allocate(size, 0, hint);
+    HEAP_UNLOCK();
+    return bp;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Turn lifetime-aware placement on or off.  While on, blocks from sites
+ *   whose observed lifetimes are short are bump-allocated from short-lived
+ *   regions of the page heap.  A region drains as a whole: the one being
+ *   carved is rewound, and any older one goes back to the page heap with
+ *   its pages purged.  Short-lived blocks too large for a region, or bound
+ *   to the heap proper, are carved from the top of the heap next to the
+ *   wilderness instead.  Neither kind leaves holes between long-lived
+ *   blocks.
+ */
+void mm_set_lifetime_mode(int on)
+{
+    HEAP_LOCK();
+    lifetime_mode = on;
+    lt_live = 0;
+    memset(lt_sites, 0, sizeof(lt_sites));
+    memset(lt_blocks, 0, sizeof(lt_blocks));
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   "st" is not NULL.
+ *
+ * Effects:
+ *   Fill in "st" with the allocator's counters since mm_init.
+ */
+void mm_get_stats(struct mm_stats *st)
+{
+    HEAP_LOCK();
+    memset(st, 0, sizeof(*st));
+    st->realloc_inplace = realloc_inplace;
+    st->realloc_copies = realloc_copies;
+    st->mesh_released = mesh_meshed;
+    st->heap_grown = heap_grown;
+    st->heap_grown_ahead = heap_grown_ahead;
+    st->extent_hits = lmap_hits;
+    st->extent_misses = lmap_misses;
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload on behalf of
+ *   allocation site "site", honouring the mm_mallocx "flags".  Returns the
+ *   address of this block if the allocation was successful and NULL
+ *   otherwise.
+ */
+static void *allocate(size_t size, int flags, uintptr_t site)
 {
     size_t asize;      /* adjusted block size */
     size_t extendsize; /* amount to extend heap if no fit */
+    size_t align = (size_t)1 << FLAG_LG_ALIGN(flags);
     char *bp;
+    bool shortlived, noshare;
+    struct span *sp;
+    int arena = FLAG_ARENA(flags), k;
 
-    /* Ignore spurious requests */
-    if (size == 0)
+    /* Ignore spurious requests and alignments no block can honour */
+    if (size == 0 || FLAG_LG_ALIGN(flags) > MM_LG_ALIGN_MAX)
         return NULL;
 
-	asize = MAX(ALIGN(size) , MINIMUM);
+    /*
+     * A block that must not share a cache line starts on one and is a
+     * whole number of lines long, so no other payload reaches its lines.
+     * Every backend below then either honours the alignment or steps
+     * aside.
+     */
+    noshare = (noshare_mode || (flags & MM_NOSHARE)) && !(flags & FLAG_HEAP);
+    if (noshare) {
+        size = (size + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+        align = MAX(align, (size_t)CACHELINE);
+    }
+
+    /*
+     * Blocks of a tenant arena come from the heap proper, whose headers
+     * carry the tag they are charged to.  At its hard limit an arena
+     * fails instead of growing.
+     */
+    if (arena != 0 || rt_mode)
+        flags |= FLAG_HEAP;
+    if (arena_hard[arena] > 0 && arenaUsage(arena) +
+        (long)MAX(ALIGN(size), MINIMUM) > (long)arena_hard[arena])
+        return NULL;
 
-	/* Search the free list for a fit. */
-	if ((bp = findFit(asize)) != NULL) {
-		place(bp, asize);
-		return (bp);
-	}
+    /* In guard mode, blocks over a page end at an inaccessible page. */
+    if (guard_mode && size > mem_pagesize() && align <= 8 &&
+        !(flags & (FLAG_HEAP | MM_COMPRESSIBLE)))
+        return guardAlloc(size);
 
-	/* No fit found.  Get more memory and place the block. */
-	extendsize = MAX(asize, CHUNKSIZE);
-	if ((bp = extendHeap(extendsize / WSIZE)) == NULL)  
-		return (NULL);
-	place(bp, asize);
-	return (bp);
-    
+    /* The largest requests get mappings of their own. */
+    if (lmap_threshold > 0 && !(flags & (FLAG_HEAP | MM_COMPRESSIBLE)) &&
+        size >= lmap_threshold && align <= LMAP_HDR &&
+        (bp = lmapAlloc(size, !(flags & MM_NOCACHE))) != NULL) {
+        if (flags & MM_ZERO)
+            memset(bp, 0, size);
+        return (bp);
+    }
+
+    /* Large requests get page spans of their own. */
+    if (span_threshold > 0 && !(flags & FLAG_HEAP) && size >= span_threshold &&
+        align <= mem_pagesize() &&
+        (sp = spanAlloc((size + mem_pagesize() - 1) / mem_pagesize(),
+        SPAN_LARGE)) != NULL) {
+        bp = sp->region->base + (size_t)sp->first * mem_pagesize();
+        if (flags & MM_ZERO)
+            memset(bp, 0, size);
+        return (bp);
+    }
+
+    /* Small requests come from mesh pages if meshing is on. */
+    if (mesh_mode && !(flags & (FLAG_HEAP | MM_COMPRESSIBLE)) &&
+        size <= MESH_MAX &&
+        align <= 16 && (bp = meshAlloc(size)) != NULL) {
+        if (flags & MM_ZERO)
+            memset(bp, 0, size);
+        return (bp);
+    }
+
+    /* Medium requests come from dense spans if out-of-band mode is on. */
+    if (size <= oob_max && !(flags & FLAG_HEAP) && align <= OOB_GRAIN &&
+        (bp = oobAlloc(size)) != NULL) {
+        if (flags & MM_ZERO)
+            memset(bp, 0, size);
+        return (bp);
+    }
+
+    /* Blocks that own their lines come from the thread's own region. */
+    if (noshare && !(flags & FLAG_HEAP) && size <= NS_MAX &&
+        align <= CACHELINE && (bp = nsAlloc(size)) != NULL) {
+        if (flags & MM_ZERO)
+            memset(bp, 0, size);
+        return (bp);
+    }
+
+    /* Sizes just under a power of two in range come from the buddy zones. */
+    if (buddy_max > 0 && !(flags & FLAG_HEAP) && (k = buddyOrder(size)) > 0 &&
+        align <= (size_t)1 << k && (bp = buddyAlloc(k)) != NULL) {
+        if (flags & MM_ZERO)
+            memset(bp, 0, size);
+        return (bp);
+    }
+
+    shortlived = lifetime_mode && !(flags & (MM_LONGLIVED | MM_NOCACHE)) &&
+        ltPredictShort(site);
+
+    /* Blocks predicted to die young share regions that drain together. */
+    if (shortlived && !(flags & FLAG_HEAP) && size <= LT_REGION_MAX &&
+        align <= DSIZE && (bp = ltRegionAlloc(size)) != NULL) {
+        ltBirth(bp, site);
+        if (flags & MM_ZERO)
+            memset(bp, 0, size);
+        return (bp);
+    }
+
+    asize = MAX(ALIGN(size) , MINIMUM);
+    if (asize > HEAP_BLOCK_MAX - MINIMUM)
+        return (NULL);
+
+    if (align > 8) {
+        /* Carve an aligned block out of a fit, growing the heap if none. */
+        if ((bp = alignedFit(asize, align)) == NULL) {
+            extendsize = MAX(asize + align + MINIMUM, CHUNKSIZE);
+            if (extendHeap(extendsize / WSIZE) == NULL ||
+                (bp = alignedFit(asize, align)) == NULL)
+                return (NULL);
+        }
+        place(bp, asize);
+    }
+    else if (flags & MM_REALLOCED) {
+        /* Sit at the bottom of the wilderness so mm_realloc can grow. */
+        if ((bp = wilderness()) == NULL ||
+            asize > (size_t)GET_SIZE(HDRP(bp))) {
+            extendsize = MAX(asize, CHUNKSIZE);
+            if ((bp = extendHeap(extendsize / WSIZE)) == NULL)
+                return (NULL);
+        }
+        place(bp, asize);
+    }
+    else if (shortlived && (bp = wilderness()) != NULL &&
+        asize <= (size_t)GET_SIZE(HDRP(bp))) {
+        /* Short-lived blocks go to the top of the wilderness if it fits. */
+        bp = placeTail(bp, asize);
+    }
+    else {
+        /* Search the free list for a fit, else get more memory. */
+        if ((bp = findFit(asize, flags & MM_LONGLIVED)) == NULL) {
+            extendsize = MAX(asize, CHUNKSIZE);
+            if ((bp = extendHeap(extendsize / WSIZE)) == NULL)
+                return (NULL);
+        }
+        if (shortlived)
+            bp = placeTail(bp, asize);
+        else
+            place(bp, asize);
+    }
+
+    if (lifetime_mode && !(flags & MM_NOCACHE))
+        ltBirth(bp, site);
+    if (flags & MM_ZERO)
+        memset(bp, 0, GET_SIZE(HDRP(bp)) - DSIZE);
+    if (noshare)
+        PUT(HDRP(bp), GET(HDRP(bp)) | 0x4);
+    PUT_ARENA(HDRP(bp), arena);
+    arenaCharge(arena, GET_SIZE(HDRP(bp)));
+    grow_demand += GET_SIZE(HDRP(bp));
+    return (bp);
 }
 
 /*
@@ -165,70 +1165,75 @@ void *mm_malloc(size_t size)
  *   Free a block.
  */
 void mm_free(void *bp)
+{
+    HEAP_LOCK();
+    freeBlock(bp);
+    HEAP_UNLOCK();
+}
+
+/*
+ * Does the work of mm_free.
+ */
+static void freeBlock(void *bp)
 {
 	/* Ignore spurious requests. */
     if(bp == NULL) 
 	return; 
+    if (freeForeign(bp))
+        return;
     size_t size = GET_SIZE(HDRP(bp));
 
+    arenaCharge(GET_ARENA(HDRP(bp)), -(long)size);
+    if (lifetime_mode)
+        ltDeath(bp);
+    if (GROWER(bp)->bp == bp)
+        GROWER(bp)->bp = NULL;
+
+    /* Hold the block back; the oldest half is released in one batch. */
+    if (quarantine_size > 0) {
+        if (quarantine_len == quarantine_size)
+            drainQuarantine((quarantine_size + 1) / 2);
+#ifdef DEBUG
+        memset(bp, POISON, size - DSIZE);
+#endif
+        quarantine[(quarantine_head + quarantine_len++) % quarantine_size] = bp;
+        return;
+    }
+
     //set header and footer to unallocated
     PUT(HDRP(bp), PACK(size, 0));
     PUT(FTRP(bp), PACK(size, 0));
-    coalesce(bp);  //coalesce and add the block to the free list
+    bp = coalesce(bp);  //coalesce and add the block to the free list
+    if (purge_min > 0 && (size_t)GET_SIZE(HDRP(bp)) >= purge_min)
+        purgeFree(bp);
 }
 
 /*
  * mm_realloc - Reallocate a block
  * This function extends or shrinks an allocated block.
  * If the new size is less than the old size, return the old pointer
- * If the new size is greater than the old size, checking it's previous and next blocks, and if free,
-* add the sizes of respective adjacent free blocks and return the pointer.
+ * If the new size is greater than the old size, checking it's next block, and if free,
+ * add the size of the adjacent free block and return the pointer.  A block
+ * at the top of the heap is grown by extending the heap behind it.
+ *
+ * A block that keeps growing is given geometric headroom: once it has been
+ * grown twice, every growth reserves twice the old size, and a copy moves
+ * it to the bottom of the wilderness.  An append-only buffer therefore
+ * copies O(log n) times and otherwise grows in place.
+ *
+ * A block within reach of mm_compress stays within reach when it moves.
  *
  * This function takes a block pointer and a new size as parameters and
  * returns a block pointer to the newly allocated block.
  */
 void *mm_realloc(void *bp, size_t size)
-{    
-	/*Ignore spurious requests */
-        if((int)size < 0) 
-    		return NULL; 
-
-	/* If size == 0 then this is just free, and we return NULL. */
-  	else if((int)size == 0){ 
-    		mm_free(bp); 
-    		return NULL; 
-  	} 
-  	else if(size > 0){ 
-      size_t oldsize = GET_SIZE(HDRP(bp)); 
-      size_t newsize = size + 2 * WSIZE; // 2 words for header and footer
-
-      /*if newsize is less than oldsize then return bp */
-      if(newsize <= oldsize){ 
-          return bp; 
-      }
-      /*if newsize is greater than oldsize */ 
-      else { 
-          size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp))); 
-          size_t csize;
-          /* if the next block is free and the size of the two blocks is greater than or equal the new size  */ 
-          /* then combine both the blocks  */ 
-          if(!next_alloc && ((csize = oldsize + GET_SIZE(HDRP(NEXT_BLKP(bp))))) >= newsize){ 
-            delete(NEXT_BLKP(bp)); 
-            PUT(HDRP(bp), PACK(csize, 1)); 
-            PUT(FTRP(bp), PACK(csize, 1)); 
-            return bp; 
-          }
-          else {  
-            void *new_ptr = mm_malloc(newsize);  
-            place(new_ptr, newsize);
-            memcpy(new_ptr, bp, newsize); 
-            mm_free(bp); 
-            return new_ptr; 
-          } 
-      }
-  }
-	else 
-    		return NULL;
+{
+    void *new_ptr;
+
+    HEAP_LOCK();
+    new_ptr = reallocate(bp, size, (uintptr_t)__builtin_return_address(0));
+    HEAP_UNLOCK();
+    return new_ptr;
 }
 
 /*
@@ -236,323 +1241,4086 @@ void *mm_realloc(void *bp, size_t size)
  *   None.
  *
  * Effects:
- *   Extend the heap with a free block and return that block's address.
+ *   Turn the geometric headroom of repeatedly grown blocks on (the
+ *   default) or off.  While off, mm_realloc grows a block to exactly the
+ *   requested size and moves it with an ordinary fit.
  */
-static void *extendHeap(size_t words)
+void mm_set_realloc_headroom(int on)
 {
-    char *bp;
-    size_t size;
+    HEAP_LOCK();
+    realloc_headroom = on;
+    HEAP_UNLOCK();
+}
 
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-    if (size < MINIMUM)
-        size = MINIMUM;
-    if ((long)(bp = mem_sbrk(size)) == -1)
-        return NULL;
+/*
+ * Does the work of mm_realloc on behalf of allocation site "site".
+ */
+static void *reallocate(void *bp, size_t size, uintptr_t site)
+{    
+    size_t oldsize, newsize, need, csize;
+    struct grower *g;
+    struct span *sp;
+    unsigned grows;
+    void *new_ptr;
+    int arena, noshare;
+    bool inplace;
+    long room;
+
+    /* Ignore spurious requests */
+    if ((int)size < 0)
+        return NULL;
+
+    /* If bp is NULL then this is just malloc. */
+    if (bp == NULL)
+        return allocate(size, 0, site);
+
+    /* If size == 0 then this is just free, and we return NULL. */
+    if (size == 0) {
+        mm_free(bp);
+        return NULL;
+    }
+    if (noshare_mode)
+        size = (size + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+
+    /*
+     * Blocks outside the boundary-tagged heap have no neighbours to grow
+     * into, so they move.  Guarded blocks move even to shrink, so that
+     * their end stays against the guard page.
+     */
+    if ((oldsize = foreignSize(bp)) != 0) {
+        if (size <= oldsize && !isGuarded(bp))
+            return bp;
+        noshare = (sp = pagemapSpan(bp)) != NULL &&
+            sp->state == SPAN_NOSHARE ? MM_NOSHARE : 0;
+        if ((new_ptr = allocate(size, noshare |
+            (mm_compressible(bp) ? MM_COMPRESSIBLE : 0), site)) == NULL)
+            return NULL;
+        memcpy(new_ptr, bp, MIN(size, oldsize));
+        mm_free(bp);
+        return new_ptr;
+    }
+
+    /* A block that owns its cache lines grows by whole lines. */
+    oldsize = GET_SIZE(HDRP(bp));
+    noshare = GET_NOSHARE(HDRP(bp)) ? MM_NOSHARE : 0;
+    if (noshare)
+        size = (size + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+    newsize = need = MAX(ALIGN(size), MINIMUM);
+
+    /* if newsize is less than oldsize then return bp */
+    if (newsize <= oldsize)
+        return bp;
+
+    /* Repeated growth of the same block earns geometric headroom. */
+    g = GROWER(bp);
+    if (g->bp != bp) {
+        g->bp = bp;
+        g->grows = 0;
+    }
+    if (realloc_headroom && ++g->grows > GROW_REPEAT)
+        newsize = MAX(newsize, 2 * oldsize);
+
+    /*
+     * Growth is charged to the block's arena: the added bytes if it grows
+     * in place, the whole new block if it moves, as allocate checks.  If
+     * the request fits under the hard limit but its headroom does not,
+     * the headroom shrinks to fit.
+     */
+    arena = GET_ARENA(HDRP(bp));
+    room = arena_hard[arena] > 0 ?
+        (long)arena_hard[arena] - arenaUsage(arena) : LONG_MAX;
+    if ((long)(need - oldsize) > room)
+        return NULL;
+    if ((long)(newsize - oldsize) > room)
+        newsize = MAX(need, (oldsize + room) & ~(size_t)(DSIZE - 1));
+
+    /*
+     * At the top of the heap, extend the heap so the next block is free.
+     * A block too large for its header to carry the arena moves instead.
+     */
+    inplace = newsize <= HEAP_BLOCK_MAX - MINIMUM;
+    if (inplace && (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0 ||
+        (!GET_ALLOC(HDRP(NEXT_BLKP(bp))) &&
+        GET_SIZE(HDRP(NEXT_BLKP(NEXT_BLKP(bp)))) == 0))) {
+        csize = oldsize + (GET_ALLOC(HDRP(NEXT_BLKP(bp))) ? 0 :
+            GET_SIZE(HDRP(NEXT_BLKP(bp))));
+        if (csize < newsize && !rt_mode &&
+            extendHeap(MAX(newsize - csize, CHUNKSIZE) / WSIZE) == NULL)
+            return NULL;
+    }
+
+    /* if the next block is free and the size of the two blocks is greater than or equal the new size  */
+    /* then combine both the blocks, splitting off the excess as place does */
+    if (inplace && !GET_ALLOC(HDRP(NEXT_BLKP(bp))) &&
+        (csize = oldsize + GET_SIZE(HDRP(NEXT_BLKP(bp)))) >= newsize &&
+        (csize - newsize >= MINIMUM || (long)(csize - oldsize) <= room)) {
+        delete(NEXT_BLKP(bp));
+        anchorDrop(NEXT_BLKP(bp), (char *)bp + csize);
+        if (csize - newsize >= MINIMUM) {
+            PUT(HDRP(bp), PACK(newsize, noshare ? 0x5 : 1));
+            PUT(FTRP(bp), PACK(newsize, 1));
+            new_ptr = NEXT_BLKP(bp);
+            PUT(HDRP(new_ptr), PACK(csize - newsize, 0));
+            PUT(FTRP(new_ptr), PACK(csize - newsize, 0));
+            add(new_ptr);
+            anchorBlock(new_ptr);
+            csize = newsize;
+        }
+        else {
+            PUT(HDRP(bp), PACK(csize, noshare ? 0x5 : 1));
+            PUT(FTRP(bp), PACK(csize, 1));
+        }
+        PUT_ARENA(HDRP(bp), arena);
+        arenaCharge(arena, csize - oldsize);
+        realloc_inplace++;
+        return bp;
+    }
+
+    /*
+     * Otherwise move the payload, next to the wilderness if it grows often,
+     * and keep it within reach of mm_compress only if it was.  The whole
+     * new block is charged while the old one is, so headroom shrinks again.
+     */
+    if ((long)newsize > room)
+        newsize = MAX(need, (size_t)room & ~(size_t)(DSIZE - 1));
+    new_ptr = allocate(newsize - DSIZE,
+        (g->grows > GROW_REPEAT ? MM_REALLOCED : 0) |
+        (mm_compressible(bp) ? MM_COMPRESSIBLE : 0) | noshare |
+        MM_ARENA(arena), site);
+    if (new_ptr == NULL)
+        return NULL;
+    memcpy(new_ptr, bp, oldsize - DSIZE);
+    mm_free(bp);
+    grows = g->grows;
+    g->bp = NULL;
+    g = GROWER(new_ptr);
+    g->bp = new_ptr;
+    g->grows = grows;
+    realloc_copies++;
+    return new_ptr;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Grow the heap ahead of demand from a background thread, or stop if
+ *   "ms" is 0.  Every "ms" milliseconds the thread measures the bytes
+ *   allocated from the heap since it last looked, and if the wilderness
+ *   holds less than four such intervals of demand, it extends the heap by
+ *   the shortfall, at least 64 KB and at most 64 MB, and faults the new
+ *   pages in with MADV_POPULATE_WRITE outside the heap lock.  Requests
+ *   then rarely extend the heap or touch a fresh page themselves.
+ *   Returns 0 on success and -1 if the thread could not be started.
+ */
+int mm_set_grow_ahead(unsigned ms)
+{
+    unsigned old;
+
+    pthread_mutex_lock(&grow_lock);
+    old = grow_ms;
+    grow_ms = ms;
+    pthread_cond_signal(&grow_wake);
+    pthread_mutex_unlock(&grow_lock);
+
+    if (old != 0 && ms == 0)
+        pthread_join(grow_thread, NULL);
+    if (old == 0 && ms != 0) {
+        if (pthread_create(&grow_thread, NULL, growAhead, NULL) != 0) {
+            grow_ms = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Requires:
+ *   "bytes" is below 2 GB.
+ *
+ * Effects:
+ *   Make the next mm_init build a real-time heap of "bytes" bytes, or an
+ *   ordinary one if "bytes" is 0.  A real-time heap is extended to its
+ *   full size at once, every page of it is faulted in, and it is locked
+ *   in memory; mm_init fails if it cannot be locked.  It never grows
+ *   afterwards, every block comes from the heap proper, and a fit search
+ *   examines at most 16 free blocks before it tries the wilderness.
+ *   Coalescing is constant-time, anchors included, since a merge rewrites
+ *   one anchor per header it absorbs rather than one per extent the block
+ *   spans.  mm_malloc and mm_free then take bounded time, as long as the
+ *   quarantine, lifetime-aware placement and the pressure monitor stay
+ *   off.  A search may miss a fit deeper in the free list, so the heap
+ *   should be sized with headroom.
+ */
+void mm_set_realtime(size_t bytes)
+{
+    HEAP_LOCK();
+    rt_size = bytes;
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   "lo" and "hi" are powers of two, or both are 0.
+ *
+ * Effects:
+ *   Serve requests within an eighth below a power of two in [lo, hi] from
+ *   a buddy allocator.  Buddy blocks have no boundary tags, are aligned to
+ *   their size, and merge with their buddy on free by flipping one address
+ *   bit.  They are carved from zones of at least four of the largest
+ *   blocks and, where the orders allow, 64 KB; a zone is added when the
+ *   others are full and given back when it drains, the last one aside.
+ *   The range is clamped so that at most 13 orders are managed.  Returns
+ *   0 on success and -1 if the range is invalid or a zone is already in
+ *   use; 0 and 0 turn the backend off for the next mm_init.
+ */
+int mm_set_buddy_range(size_t lo, size_t hi)
+{
+    size_t bit;
+    int j;
+
+    HEAP_LOCK();
+    if (buddy_zones != NULL || (lo & (lo - 1)) || (hi & (hi - 1)) ||
+        lo > hi || (lo == 0) != (hi == 0)) {
+        HEAP_UNLOCK();
+        return -1;
+    }
+    if (lo == 0) {
+        buddy_min = buddy_max = 0;
+        HEAP_UNLOCK();
+        return 0;
+    }
+    buddy_min = MAX(__builtin_ctzl(lo), 4);
+    buddy_max = MAX(__builtin_ctzl(hi), buddy_min);
+    buddy_top = MIN(MAX(buddy_max + BUDDY_ZONE, BUDDY_ZONE_MIN),
+        buddy_min + BUDDY_ORDERS - 1);
+    buddy_max = MIN(buddy_max, buddy_top - 1);
+    for (bit = 0, j = buddy_min; j <= buddy_top; j++) {
+        buddy_base[j - buddy_min] = bit;
+        bit += (size_t)1 << (buddy_top - j);
+    }
+    HEAP_UNLOCK();
+    return 0;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Serve requests of at least "bytes" bytes as page spans of their own,
+ *   carved from the page heap rather than split from free blocks; 0 turns
+ *   this off.  Spans are page-aligned and have no boundary tags.
+ */
+void mm_set_span_threshold(size_t bytes)
+{
+    HEAP_LOCK();
+    span_threshold = bytes;
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Serve requests of at least "threshold" bytes from page-aligned
+ *   mappings of their own, or stop if "threshold" is 0.  A freed mapping
+ *   is retained for reuse instead of unmapped, as long as at most
+ *   "retain" bytes in 64 mappings are retained; beyond that the oldest
+ *   are unmapped.  Retained mappings are binned by size class: a request
+ *   takes the smallest that fits in its own class or else the first of a
+ *   larger class, without looking at live ones, and splits off a
+ *   remainder of 64 KB or more; a request made with MM_NOCACHE always
+ *   gets a new mapping.  Retained mappings that are adjacent merge.
+ *   mm_get_stats reports hits and misses of the retained mappings.
+ */
+void mm_set_extents(size_t threshold, size_t retain)
+{
+    HEAP_LOCK();
+    lmap_threshold = threshold;
+    lmap_retain = retain;
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Unmap every retained mapping released at least "ms" milliseconds
+ *   ago, oldest first; 0 unmaps them all.  Returns the number of bytes
+ *   unmapped.
+ */
+size_t mm_extent_purge(unsigned ms)
+{
+    uint64_t now = lmapClock();
+    size_t bytes = 0;
+
+    HEAP_LOCK();
+    while (lmap_oldest != NULL && now - lmap_oldest->released >= ms) {
+        bytes += lmap_oldest->len;
+        lmapUnmap(lmap_oldest);
+    }
+    HEAP_UNLOCK();
+    return bytes;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Give the pages of every free span back to the system with madvise.
+ *   The spans stay in the page heap and are refilled with zeroes on their
+ *   next use.  Returns the number of bytes purged.
+ */
+size_t mm_span_purge(void)
+{
+    struct span *sp;
+    size_t bytes = 0;
+    int b;
+
+    HEAP_LOCK();
+    for (b = 0; b < SPAN_BINS; b++)
+        for (sp = span_bins[b]; sp != NULL; sp = sp->next) {
+            if (sp->purged)
+                continue;
+            madvise(sp->region->base + (size_t)sp->first * mem_pagesize(),
+                (size_t)sp->npages * mem_pagesize(), MADV_DONTNEED);
+            sp->purged = true;
+            bytes += (size_t)sp->npages * mem_pagesize();
+        }
+    HEAP_UNLOCK();
+    return bytes;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Give the interior pages of every free heap block back to the system
+ *   with madvise.  The free-list links and boundary tags stay resident;
+ *   the purged pages read as zeroes when reused.  Returns the number of
+ *   bytes purged.
+ */
+size_t mm_purge(void)
+{
+    size_t bytes = 0;
+    void *bp;
+
+    HEAP_LOCK();
+    for (bp = free_listp; GET_ALLOC(HDRP(bp)) == 0; bp = NEXT_FREEP(bp))
+        bytes += purgeFree(bp);
+    HEAP_UNLOCK();
+    return bytes;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Take memory-pressure samples from "fn" with context "ctx" instead of
+ *   from the system, for instance to test the reaction to pressure.
+ *   "fn" returns 0 on success and -1 if no sample could be taken.  A NULL
+ *   "fn" goes back to the system: the "some" avg10 stall share of
+ *   /proc/pressure/memory, and memory.max and memory.current of the
+ *   process's cgroup v2.
+ */
+void mm_set_pressure_source(mm_pressure_src fn, void *ctx)
+{
+    pthread_mutex_lock(&pressure_lock);
+    pressure_src = fn;
+    pressure_ctx = ctx;
+    pthread_mutex_unlock(&pressure_lock);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Take a pressure sample and react to its level.  The level is the
+ *   higher of that of the memory stall share (any, 1%, 10%) and that of
+ *   the cgroup usage against its limit (70%, 80%, 90%).  Each level keeps
+ *   the reactions of those below it:
+ *     MM_PRESSURE_LOW:  free spans are purged;
+ *     MM_PRESSURE_HIGH: the free quarantine is flushed, free heap blocks
+ *       are purged, and free then purges any block it leaves at least
+ *       64 KB long;
+ *     MM_PRESSURE_CRITICAL: free purges any block holding a whole page.
+ *   A lower level relaxes free again.  The heap cannot shrink below its
+ *   break, so the wilderness is trimmed by purging it like any free
+ *   block.  Mesh pages are not folded, since mm_mesh requires that no
+ *   other thread touch mesh-heap blocks; callers that can promise that
+ *   call it themselves.  Returns the level, or -1 if no sample could be
+ *   taken.
+ */
+int mm_pressure_poll(void)
+{
+    struct mm_pressure_sample ps = {0.0, 0, 0};
+    double use;
+    int level, ret;
+
+    pthread_mutex_lock(&pressure_lock);
+    ret = (pressure_src != NULL ? pressure_src : pressureRead)(&ps,
+        pressure_ctx);
+    pthread_mutex_unlock(&pressure_lock);
+    if (ret != 0)
+        return -1;
+
+    use = ps.limit > 0 ? (double)ps.current / ps.limit : 0.0;
+    level = ps.some_avg10 >= 10.0 || use >= 0.9 ? MM_PRESSURE_CRITICAL :
+        ps.some_avg10 >= 1.0 || use >= 0.8 ? MM_PRESSURE_HIGH :
+        ps.some_avg10 > 0.0 || use >= 0.7 ? MM_PRESSURE_LOW :
+        MM_PRESSURE_NONE;
+
+    HEAP_LOCK();
+    pressure_level = level;
+    purge_min = level == MM_PRESSURE_CRITICAL ? 2 * mem_pagesize() :
+        level == MM_PRESSURE_HIGH ? 65536 : 0;
+    if (level >= MM_PRESSURE_LOW)
+        mm_span_purge();
+    if (level >= MM_PRESSURE_HIGH) {
+        mm_flush_quarantine();
+        mm_purge();
+    }
+    HEAP_UNLOCK();
+    return level;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Poll the memory pressure every "ms" milliseconds on a background
+ *   thread, or stop polling if "ms" is 0.  Returns 0 on success and -1
+ *   if the thread could not be started.
+ */
+int mm_pressure_monitor(unsigned ms)
+{
+    unsigned old;
+
+    pthread_mutex_lock(&pressure_lock);
+    old = pressure_ms;
+    pressure_ms = ms;
+    pthread_cond_signal(&pressure_wake);
+    pthread_mutex_unlock(&pressure_lock);
+
+    if (old != 0 && ms == 0)
+        pthread_join(pressure_thread, NULL);
+    if (old == 0 && ms != 0) {
+        if (pthread_create(&pressure_thread, NULL, pressureMonitor,
+            NULL) != 0) {
+            pressure_ms = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Requires:
+ *   "arena" is below 16.  "soft" is 0 or at most "hard", unless "hard" is
+ *   0.
+ *
+ * Effects:
+ *   Set the budget of "arena", in bytes of heap blocks including their
+ *   boundary tags; 0 means no limit.  Arenas are tenants of the one heap:
+ *   blocks of arenas other than 0 always come from the heap proper, whose
+ *   headers carry their arena, while arena 0 also owns the regions and
+ *   zones the other backends carve from the heap.  When an allocation
+ *   takes an arena over its soft limit, the arena's blocks in the free
+ *   quarantine are released and their pages purged, along with the free
+ *   spans for arena 0, and then "fn", if not NULL, is called with the
+ *   arena, its usage, the soft limit and "ctx"; this happens again only
+ *   after the arena drops back below the limit.  An allocation that
+ *   would take an arena over its hard limit fails, and so does a
+ *   reallocation, counting only the added bytes of a block that grows in
+ *   place and the whole new block of one that moves; realloc headroom is
+ *   cut to stay under the limit.  The header carries the arena, so a heap
+ *   block is at most 256 MB.
+ *   Threads publish usage in steps of 64 KB, so either limit may be
+ *   overshot by that much per thread.  Returns 0 on success and -1 if the
+ *   arguments are invalid.
+ */
+int mm_set_arena_budget(int arena, size_t soft, size_t hard,
+    mm_pressure_fn fn, void *ctx)
+{
+    if (arena < 0 || arena >= ARENAS || (hard > 0 && soft > hard))
+        return -1;
+    HEAP_LOCK();
+    arena_soft[arena] = soft;
+    arena_hard[arena] = hard;
+    arena_fn[arena] = fn;
+    arena_ctx[arena] = ctx;
+    arena_over[arena] = false;
+    HEAP_UNLOCK();
+    return 0;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the bytes of heap blocks charged to "arena", as published by
+ *   the other threads and exactly for the calling thread, or 0 if there
+ *   is no such arena.
+ */
+size_t mm_arena_usage(int arena)
+{
+    long used;
+
+    if (arena < 0 || arena >= ARENAS)
+        return 0;
+    used = arenaUsage(arena);
+    return used > 0 ? (size_t)used : 0;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Turn the mesh heap on or off.  While on, requests of up to 1024 bytes
+ *   are served from pages that each hold one size class, in a heap backed
+ *   by a memfd so that mm_mesh can later fold pages together.
+ */
+void mm_set_mesh(int on)
+{
+    HEAP_LOCK();
+    mesh_mode = on;
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   No other thread touches mesh-heap blocks during the call.
+ *
+ * Effects:
+ *   Find pairs of partly used pages of the same size class whose objects
+ *   do not overlap, whatever their colours, copy the objects of one into
+ *   the other at the same offsets, and map both virtual pages onto the
+ *   surviving physical page.  The other physical page is punched out of
+ *   the memfd.  No block moves as far as its users can tell.  Returns the
+ *   number of physical pages released.
+ */
+size_t mm_mesh(void)
+{
+    struct mpage *a, *b, *next;
+    size_t released = 0;
+    int c;
+
+    HEAP_LOCK();
+    for (c = 0; mesh_base != NULL && c < MESH_CLASSES; c++) {
+        for (a = mesh_partial[c]; a != NULL; a = a->next) {
+            for (b = a->next; b != NULL; b = next) {
+                next = b->next;
+                if (a->nalias + b->nalias > MESH_ALIAS ||
+                    meshOverlap(a, b))
+                    continue;
+                meshFold(a, b);
+                released++;
+                if (a->nfree == 0)
+                    break;
+            }
+        }
+    }
+    mesh_meshed += released;
+    HEAP_UNLOCK();
+    return released;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Give every block, not only those allocated with MM_NOSHARE, cache
+ *   lines of its own, so that blocks handed to different threads never
+ *   share one.  Blocks of up to 1 KB are carved from line-aligned regions
+ *   of the calling thread, and larger ones come line-aligned from the heap
+ *   proper.  mm_realloc keeps such a block on whole lines.
+ */
+void mm_set_noshare(int on)
+{
+    HEAP_LOCK();
+    noshare_mode = on;
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns true if "p" lies within the heap reservation, where
+ *   mm_compress can encode it, and false otherwise.  Mesh pages and guarded
+ *   blocks are mapped outside of it.
+ */
+int mm_compressible(const void *p)
+{
+    return (char *)p >= (char *)mem_heap_lo() &&
+        (char *)p <= (char *)mem_heap_hi() &&
+        (size_t)((char *)p - mm_compress_base) >> MM_COMPRESS_SHIFT <=
+        UINT32_MAX;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Serve requests of up to "max" bytes (at most 64 KB) from dense spans:
+ *   page spans whose payloads are packed back to back, with block sizes,
+ *   allocation state and free-space links kept in a separate metadata
+ *   block.  Walking or freeing such blocks touches only the metadata; 0
+ *   turns this off.
+ */
+void mm_set_oob(size_t max)
+{
+    HEAP_LOCK();
+    oob_max = MIN(max, (size_t)OOB_MAX);
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Set the free quarantine to hold up to "n" blocks (at most 1024); 0
+ *   turns it off.  Freed blocks then stay allocated until the ring fills,
+ *   and the oldest half is released as one address-sorted batch, so that
+ *   neighbouring frees merge in one step.  Blocks already held are
+ *   released first.  The quarantine is off until set here: it pays off
+ *   when runs of neighbours are freed together, above all while free
+ *   purges pages, and only costs time and memory on random churn.
+ */
+void mm_set_quarantine(size_t n)
+{
+    HEAP_LOCK();
+    mm_flush_quarantine();
+    quarantine_size = MIN(n, (size_t)QUARANTINE_MAX);
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Release every block held in the free quarantine.
+ */
+void mm_flush_quarantine(void)
+{
+    HEAP_LOCK();
+    drainQuarantine(quarantine_len);
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   At most 64 threads use epochs at a time.
+ *
+ * Effects:
+ *   Enter a read-side critical section.  Until the matching mm_epoch_exit,
+ *   no block passed to mm_free_deferred by any thread after this thread
+ *   could still reach it is released.  Sections nest.  Returns 0 on
+ *   success and -1 if every epoch record is taken.
+ */
+int mm_epoch_enter(void)
+{
+    struct ethread *et;
+
+    if ((et = epochSelf()) == NULL)
+        return -1;
+    if (et->depth++ == 0)
+        __atomic_store_n(&et->epoch, __atomic_load_n(&epoch_global,
+            __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+/*
+ * Requires:
+ *   The calling thread is in a section begun by mm_epoch_enter.
+ *
+ * Effects:
+ *   Leave the innermost read-side critical section.
+ */
+void mm_epoch_exit(void)
+{
+    struct ethread *et = epoch_self;
+
+    if (et != NULL && et->depth > 0 && --et->depth == 0)
+        __atomic_store_n(&et->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block that no new reader can
+ *   reach, or NULL.
+ *
+ * Effects:
+ *   Free "bp" once every thread that was in an epoch section when it was
+ *   retired has left that section.  Retired blocks are kept per thread and
+ *   per epoch; whenever the global epoch has moved two steps past a bag,
+ *   the whole bag is released in address-sorted batches.  The bags record
+ *   blocks in arrays of their own and never write to a retired block.  The
+ *   bags of a thread that exits are released by later calls from other
+ *   threads.  If every epoch record is taken, the block is freed at once.
+ *   A thread only fills its own bags, and releases always take the heap
+ *   lock, so threads may retire blocks at the same time without any
+ *   serialization of their own.
+ */
+void mm_free_deferred(void *bp)
+{
+    struct ethread *et;
+    struct echunk *c;
+    uint64_t e;
+    int i;
+
+    if (bp == NULL)
+        return;
+    if ((et = epochSelf()) == NULL) {
+        mm_free(bp);
+        return;
+    }
+
+    e = __atomic_load_n(&epoch_global, __ATOMIC_SEQ_CST);
+    for (i = 0; i < 3; i++)
+        if (et->nbag[i] > 0 && et->bag_epoch[i] + 2 <= e)
+            epochRelease(et, i);
+    if (__atomic_load_n(&epoch_orphans, __ATOMIC_RELAXED) != NULL)
+        epochOrphans(e);
+
+    /* Blocks are recorded in chunks of their own, not linked in place. */
+    i = e % 3;
+    if ((c = et->bag[i]) == NULL || c->n == EPOCH_SPILL) {
+        pthread_mutex_lock(&epoch_lock);
+        if ((c = epoch_spare) != NULL)
+            epoch_spare = c->next;
+        pthread_mutex_unlock(&epoch_lock);
+        if (c == NULL && (c = mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+            HEAP_LOCK();
+            freeBlock(bp);
+            HEAP_UNLOCK();
+            return;
+        }
+        c->n = 0;
+        c->next = et->bag[i];
+        et->bag[i] = c;
+    }
+    et->bag_epoch[i] = e;
+    c->v[c->n++] = bp;
+    if (++et->nbag[i] % EPOCH_BATCH == 0 && epochAdvance(e)) {
+        for (i = 0; i < 3; i++)
+            if (et->nbag[i] > 0 && et->bag_epoch[i] + 2 <= e + 1)
+                epochRelease(et, i);
+    }
+}
+
+/*
+ * Requires:
+ *   "bp" is either the address of an allocated block or NULL.
+ *
+ * Effects:
+ *   Free a block later, on a background reclaimer thread.  The caller only
+ *   stores "bp" in a buffer of its own; each full buffer goes to the
+ *   reclaimer, which frees it as one address-sorted batch.  The first call
+ *   starts the reclaimer.  Frees the block at once if no thread can be
+ *   started.
+ */
+void mm_free_async(void *bp)
+{
+    struct abatch *b = async_self;
+
+    if (bp == NULL)
+        return;
+    if (b != NULL) {
+        /* Blocks buffered before an mm_init are gone with their heap. */
+        if (b->generation != heap_generation) {
+            b->generation = heap_generation;
+            b->n = 0;
+        }
+        b->v[b->n++] = bp;
+        if (b->n == ASYNC_BATCH)
+            asyncHand(b);
+        return;
+    }
+
+    pthread_once(&async_once, asyncStart);
+    if (!async_running) {
+        mm_free(bp);
+        return;
+    }
+    pthread_mutex_lock(&async_lock);
+    if ((b = async_spare) != NULL)
+        async_spare = b->next;
+    pthread_mutex_unlock(&async_lock);
+    if (b == NULL && (b = mmap(NULL, sizeof(*b), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        mm_free(bp);
+        return;
+    }
+    b->generation = heap_generation;
+    b->n = 0;
+    b->v[b->n++] = bp;
+    async_self = b;
+    pthread_setspecific(async_key, b);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Hand the calling thread's buffer of mm_free_async calls to the
+ *   reclaimer and wait until every buffer handed to it so far is freed.
+ *   Buffers other threads are still filling are not included.
+ */
+void mm_free_async_flush(void)
+{
+    if (async_self != NULL)
+        asyncHand(async_self);
+    pthread_mutex_lock(&async_lock);
+    while (async_busy > 0)
+        pthread_cond_wait(&async_idle, &async_lock);
+    pthread_mutex_unlock(&async_lock);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocate a relocatable block with at least "size" bytes of payload and
+ *   return a handle to it, or NULL if the allocation failed.  The payload
+ *   is reached through *handle, which mm_compact may change while the
+ *   block is unlocked.
+ */
+mm_handle_t mm_halloc(size_t size)
+{
+    struct hentry *h;
+    void *bp;
+    int i;
+
+    HEAP_LOCK();
+    /* Grow the handle table; its chunks are never moved. */
+    if (free_handles == NULL) {
+        h = allocate(HCHUNK * sizeof(*h), MM_LONGLIVED | MM_NOCACHE, 0);
+        if (h == NULL) {
+            HEAP_UNLOCK();
+            return NULL;
+        }
+        for (i = 0; i < HCHUNK; i++)
+            h[i].next = i + 1 < HCHUNK ? &h[i + 1] : NULL;
+        free_handles = h;
+    }
+    /* The block needs boundary tags, so it comes from the heap proper. */
+    if ((bp = allocate(size + WSIZE, FLAG_HEAP | MM_NOCACHE, 0)) == NULL) {
+        HEAP_UNLOCK();
+        return NULL;
+    }
+    h = free_handles;
+    free_handles = h->next;
+
+    PUT(HDRP(bp), GET(HDRP(bp)) | 0x2);
+    *(struct hentry **)bp = h;
+    h->ptr = (char *)bp + WSIZE;
+    h->locks = 0;
+    HEAP_UNLOCK();
+    return &h->ptr;
+}
+
+/*
+ * Requires:
+ *   "handle" was returned by mm_halloc and not yet freed.
+ *
+ * Effects:
+ *   Pin the handle's block so that mm_compact leaves it in place, and
+ *   return its payload address.  Locks nest.
+ */
+void *mm_hlock(mm_handle_t handle)
+{
+    void *p;
+
+    HEAP_LOCK();
+    ((struct hentry *)handle)->locks++;
+    p = *handle;
+    HEAP_UNLOCK();
+    return p;
+}
+
+/*
+ * Requires:
+ *   "handle" is locked.
+ *
+ * Effects:
+ *   Undo one mm_hlock.  Once all locks are gone the block may move.
+ */
+void mm_hunlock(mm_handle_t handle)
+{
+    HEAP_LOCK();
+    ((struct hentry *)handle)->locks--;
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   "handle" was returned by mm_halloc or is NULL.
+ *
+ * Effects:
+ *   Free the handle's block and the handle itself.
+ */
+void mm_hfree(mm_handle_t handle)
+{
+    struct hentry *h = (struct hentry *)handle;
+    void *bp;
+
+    if (h == NULL)
+        return;
+    HEAP_LOCK();
+    bp = (char *)h->ptr - WSIZE;
+    PUT(HDRP(bp), GET(HDRP(bp)) & ~0x2);
+    freeBlock(bp);
+    h->next = free_handles;
+    free_handles = h;
+    HEAP_UNLOCK();
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Slide every unlocked handle block down toward heap_listp, over the free
+ *   blocks in front of it, and merge the free space left behind into one
+ *   free block in front of each pinned block and one at the top of the
+ *   heap.  Returns the size of the free block at the top of the heap.  The
+ *   break itself never moves back, so the top block is kept as the
+ *   wilderness for later allocations.
+ */
+size_t mm_compact(void)
+{
+    void *bp, *next, *dst = NULL;
+    struct hentry *h;
+    size_t size;
+
+    HEAP_LOCK();
+    for (bp = FIRST_BLKP; (size = GET_SIZE(HDRP(bp))) > 0; bp = next) {
+        next = NEXT_BLKP(bp);
+        if (!GET_ALLOC(HDRP(bp))) {
+            /* Free space joins the gap; the list entry is rebuilt below. */
+            delete(bp);
+            if (dst == NULL)
+                dst = bp;
+        }
+        else if (dst != NULL && GET_RELOC(HDRP(bp)) &&
+            (h = *(struct hentry **)bp)->locks == 0) {
+            /* Slide the whole block, header to footer, into the gap. */
+            memmove(HDRP(dst), HDRP(bp), size);
+            h->ptr = (char *)dst + WSIZE;
+            dst = NEXT_BLKP(dst);
+        }
+        else if (dst != NULL) {
+            /* A pinned block closes the gap in front of it. */
+            PUT(HDRP(dst), PACK((char *)bp - (char *)dst, 0));
+            PUT(FTRP(dst), PACK((char *)bp - (char *)dst, 0));
+            coalesce(dst);
+            dst = NULL;
+        }
+    }
+    if (dst == NULL) {
+        anchorRebuild();
+        HEAP_UNLOCK();
+        return 0;
+    }
+    size = (char *)bp - (char *)dst;
+    PUT(HDRP(dst), PACK(size, 0));
+    PUT(FTRP(dst), PACK(size, 0));
+    coalesce(dst);
+    anchorRebuild();
+    HEAP_UNLOCK();
+    return size;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Walk the heap once, merge any runs of adjacent free blocks, and rebuild
+ *   the free list from scratch: grouped by size class, smallest class first,
+ *   and in ascending address order within each class.  First-fit searches
+ *   that follow then touch memory in address order.  Returns the number of
+ *   blocks in the rebuilt free list.
+ */
+size_t mm_defrag_index(void)
+{
+    void *heads[CLASSES], *tails[CLASSES];
+    void *bp, *run = NULL, *prev = NULL;
+    size_t size, c, count = 0;
+
+    HEAP_LOCK();
+    memset(heads, 0, sizeof(heads));
+    for (bp = FIRST_BLKP; ; bp = NEXT_BLKP(bp)) {
+        if (GET_SIZE(HDRP(bp)) > 0 && !GET_ALLOC(HDRP(bp))) {
+            /* Extend the current run; bp's own header stays readable. */
+            if (run == NULL) {
+                run = bp;
+                continue;
+            }
+            size = GET_SIZE(HDRP(run)) + GET_SIZE(HDRP(bp));
+            PUT(HDRP(run), PACK(size, 0));
+            PUT(FTRP(run), PACK(size, 0));
+            continue;
+        }
+        if (run != NULL) {
+            /* Append the finished run to the tail of its class. */
+            c = SIZE_CLASS((size_t)GET_SIZE(HDRP(run)));
+            if (heads[c] == NULL)
+                heads[c] = run;
+            else
+                NEXT_FREEP(tails[c]) = run;
+            PREV_FREEP(run) = heads[c] == run ? NULL : tails[c];
+            tails[c] = run;
+            run = NULL;
+            count++;
+        }
+        if (GET_SIZE(HDRP(bp)) == 0)
+            break;
+    }
+
+    /* Chain the classes together, ending at the prologue as before. */
+    free_listp = heap_listp + DSIZE;
+    for (c = 0; c < CLASSES; c++) {
+        if (heads[c] == NULL)
+            continue;
+        if (prev == NULL)
+            free_listp = heads[c];
+        else {
+            NEXT_FREEP(prev) = heads[c];
+            PREV_FREEP(heads[c]) = prev;
+        }
+        prev = tails[c];
+    }
+    if (prev != NULL) {
+        bp = heap_listp + DSIZE;
+        NEXT_FREEP(prev) = bp;
+        PREV_FREEP(bp) = prev;
+    }
+    anchorRebuild();
+    HEAP_UNLOCK();
+    return count;
+}
+
+/*
+ * Requires:
+ *   "fn" is not NULL.
+ *
+ * Effects:
+ *   Call "fn" once for each block of the heap, in address order, or, with
+ *   MM_WALK_FREE, once for each block of the free list, in list order.
+ *   The walk stops early when "fn" returns nonzero, and that value is
+ *   returned; otherwise 0 is returned.
+ *
+ *   Without MM_WALK_SNAPSHOT "fn" must not allocate or free.  With it, the
+ *   blocks are first copied into a buffer allocated from the heap (and left
+ *   out of the walk), so "fn" sees the heap as it was when the walk started
+ *   and may call back into the allocator.  Returns -1 if that buffer could
+ *   not be allocated.  The heap lock is held while the heap is read, so
+ *   other threads wait for a direct walk but only for the copy of a
+ *   snapshot.
+ */
+int mm_heap_walk(mm_walk_fn fn, void *ctx, int flags)
+{
+    struct mm_block_info info, *snap = NULL;
+    size_t i, n = 0;
+    void *bp;
+    int ret = 0;
+
+    HEAP_LOCK();
+    if (flags & MM_WALK_SNAPSHOT) {
+        /* Room for every block plus the two the buffer may split off. */
+        for (bp = FIRST_BLKP; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+            n++;
+        snap = allocate((n + 2) * sizeof(*snap), MM_NOCACHE, 0);
+        if (snap == NULL) {
+            HEAP_UNLOCK();
+            return -1;
+        }
+        n = 0;
+    }
+
+    bp = (flags & MM_WALK_FREE) ? free_listp : FIRST_BLKP;
+    while (GET_SIZE(HDRP(bp)) > 0 &&
+        !((flags & MM_WALK_FREE) && GET_ALLOC(HDRP(bp)))) {
+        info.addr = bp;
+        info.size = GET_SIZE(HDRP(bp));
+        info.alloc = GET_ALLOC(HDRP(bp));
+        info.arena = info.alloc ? GET_ARENA(HDRP(bp)) : 0;
+        if (snap != NULL) {
+            if (bp != (void *)snap)
+                snap[n++] = info;
+        }
+        else if ((ret = fn(&info, ctx)) != 0)
+            break;
+        bp = (flags & MM_WALK_FREE) ? NEXT_FREEP(bp) : NEXT_BLKP(bp);
+    }
+    HEAP_UNLOCK();
+
+    for (i = 0; i < n && ret == 0; i++)
+        ret = fn(&snap[i], ctx);
+    if (snap != NULL)
+        mm_free(snap);
+    return ret;
+}
+
+/* One thread's share of a parallel heap walk */
+struct walkpart {
+    pthread_t tid;
+    size_t lo, hi;           /* heap offsets of the blocks to visit */
+    mm_walk_fn fn;
+    void *ctx;
+    int ret;                 /* first nonzero callback result */
+    volatile int *stop;      /* set once any part stops early */
+};
+
+/*
+ * Requires:
+ *   "fn" is not NULL and safe to call from several threads at once, and
+ *   it does not allocate or free.
+ *
+ * Effects:
+ *   Like mm_heap_walk without flags, but the heap is split into runs of
+ *   64 KB extents that are walked by up to "nthreads" threads at once, or
+ *   by the caller alone if "nthreads" is below 2, each starting from the
+ *   first block anchored in its run.  Blocks are visited in
+ *   address order within a run only.  Returns the first nonzero value
+ *   returned by "fn", or 0.  The heap is not modified, so the walk sees
+ *   the same blocks as mm_heap_walk.
+ */
+int mm_heap_walk_parallel(mm_walk_fn fn, void *ctx, int nthreads)
+{
+    struct walkpart parts[WALKERS];
+    size_t extents, started, t;
+    volatile int stop = 0;
+    int ret = 0;
+
+    /* The walkers only read, under the caller's hold of the heap lock. */
+    HEAP_LOCK();
+    extents = (mem_heapsize() + (1 << EXTENT_SHIFT) - 1) >> EXTENT_SHIFT;
+    if (extents > ANCHORS)
+        extents = ANCHORS;
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > WALKERS)
+        nthreads = WALKERS;
+    if ((size_t)nthreads > extents)
+        nthreads = extents;
+
+    for (t = 0; t < (size_t)nthreads; t++) {
+        parts[t].lo = (t * extents / nthreads) << EXTENT_SHIFT;
+        parts[t].hi = t + 1 < (size_t)nthreads ?
+            ((t + 1) * extents / nthreads) << EXTENT_SHIFT : SIZE_MAX;
+        parts[t].fn = fn;
+        parts[t].ctx = ctx;
+        parts[t].ret = 0;
+        parts[t].stop = &stop;
+    }
+
+    /* The caller walks the first part and any part whose thread failed. */
+    for (t = 1; t < (size_t)nthreads; t++)
+        if (pthread_create(&parts[t].tid, NULL, walkExtents, &parts[t]) != 0)
+            break;
+    started = t;
+    walkExtents(&parts[0]);
+    for (t = started; t < (size_t)nthreads; t++)
+        walkExtents(&parts[t]);
+    for (t = 1; t < started; t++)
+        pthread_join(parts[t].tid, NULL);
+    HEAP_UNLOCK();
+
+    for (t = 0; t < (size_t)nthreads && ret == 0; t++)
+        ret = parts[t].ret;
+    return ret;
+}
+
+/* Top of the main thread's stack and bounds of the data and bss segments */
+extern void *__libc_stack_end;
+extern char __data_start[], _end[];
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Find allocated blocks that nothing points to.  The registers and stack
+ *   of the calling thread and the data and bss segments are scanned
+ *   conservatively for words that point into an allocated payload, and the
+ *   payloads found are scanned in turn, by walkers that split the heap
+ *   between them.  Blocks of the buddy zone, of the mesh heap, and of
+ *   mappings of their own, guarded or not, are checked one by one;
+ *   blocks of the other backends are checked as the heap blocks that
+ *   hold them.  Unreached blocks are reported grouped by
+ *   size, and also by allocation site if lifetime sampling is on.  Returns
+ *   the number of leaked blocks, or -1 if the checker's work buffer could
+ *   not be allocated.
+ *
+ *   Only the calling thread's stack is scanned, so blocks that only other
+ *   threads refer to are reported as leaked.
+ */
+long mm_leak_check(int verbose)
+{
+    struct leakwalk lw;
+    struct leakent *v;
+    size_t n = 0, i, j, bytes, off;
+    struct ltblock *lb;
+    struct bzone *z;
+    bool used;
+    void *bp;
+    int k;
+
+    HEAP_LOCK();
+
+    /* Size the work buffer; it may split off up to two extra blocks. */
+    for (bp = FIRST_BLKP; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+        n += GET_ALLOC(HDRP(bp));
+    for (z = buddy_zones; z != NULL; z = z->next)
+        for (off = 0; off >> buddy_top == 0; off += (size_t)1 << k) {
+            k = buddyBlock(z, off, &used);
+            n += used;
+        }
+    n += leakMesh(NULL) + leakMaps(NULL);
+    v = allocate((n + 2) * sizeof(*v), FLAG_HEAP | MM_NOCACHE, 0);
+    if (v == NULL) {
+        HEAP_UNLOCK();
+        return -1;
+    }
+
+    /*
+     * Record the allocated blocks in address order, except the buffer.
+     * A buddy zone is replaced by its blocks, each sized like a heap block
+     * with its payload and tags, and its bookkeeping is left out.
+     */
+    n = 0;
+    for (bp = FIRST_BLKP; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (!GET_ALLOC(HDRP(bp)) || bp == (void *)v)
+            continue;
+        if ((z = buddyOf(bp)) != NULL && bp == (void *)z->base) {
+            for (off = 0; off >> buddy_top == 0; off += (size_t)1 << k) {
+                k = buddyBlock(z, off, &used);
+                if (!used)
+                    continue;
+                v[n].bp = z->base + off;
+                v[n].size = ((size_t)1 << k) + DSIZE;
+                v[n].site = 0;
+                v[n].mark = 0;
+                n++;
+            }
+            continue;
+        }
+        v[n].bp = bp;
+        v[n].size = GET_SIZE(HDRP(bp));
+        v[n].site = 0;
+        v[n].mark = 0;
+        n++;
+    }
+    j = leakMesh(v + n);
+    j += leakMaps(v + n + j);
+    if (j > 0) {
+        n += j;
+        qsort(v, n, sizeof(*v), leakByAddress);
+    }
+
+    /*
+     * Mark from the roots, then scan the marked blocks on parallel walks
+     * of the heap, and those outside it here, until a pass leaves none
+     * unscanned.
+     */
+    lw.v = v;
+    lw.n = n;
+    leakRoots(&lw);
+    do {
+        lw.again = 0;
+        mm_heap_walk_parallel(leakWalk, &lw, walkThreads());
+        for (i = 0; i < n; i++)
+            if (v[i].mark == LEAK_MARKED && !inHeap(v[i].bp)) {
+                leakDrain(&lw, &v[i]);
+                lw.again = 1;
+            }
+    } while (lw.again);
+
+    /* Move the leaked blocks to the front and report them. */
+    for (i = j = 0; i < n; i++) {
+        if (v[i].mark)
+            continue;
+        if (lifetime_mode && inHeap(v[i].bp)) {
+            lb = ltSlot(v[i].bp - heap_listp);
+            if (lb->off != 0 && lt_sites[lb->site].gen == lb->gen)
+                v[i].site = lt_sites[lb->site].site;
+        }
+        v[j++] = v[i];
+    }
+    n = j;
+    if (verbose && n > 0) {
+        qsort(v, n, sizeof(*v), leakBySize);
+        for (i = 0; i < n; i = j) {
+            for (j = i; j < n && v[j].size == v[i].size; j++)
+                ;
+            printf("Leaked %zu blocks of size %zu, e.g. %p\n", j - i,
+                v[i].size, v[i].bp);
+        }
+        if (lifetime_mode) {
+            qsort(v, n, sizeof(*v), leakBySite);
+            for (i = 0; i < n; i = j) {
+                for (bytes = 0, j = i; j < n && v[j].site == v[i].site; j++)
+                    bytes += v[j].size;
+                if (v[i].site != 0)
+                    printf("Leaked %zu blocks, %zu bytes, from site %#lx\n",
+                        j - i, bytes, (unsigned long)v[i].site);
+            }
+        }
+    }
+    mm_free(v);
+    HEAP_UNLOCK();
+    return n;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Extend the heap with a free block and return that block's address.
+ */
+static void *extendHeap(size_t words)
+{
+    char *bp;
+    size_t size;
+
+    /* A real-time heap never grows. */
+    if (rt_mode)
+        return NULL;
+
+    /* Allocate an even number of words to maintain alignment */
+    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+    if (size < MINIMUM)
+        size = MINIMUM;
+    if (size > INT_MAX)     /* beyond mem_sbrk and the header's reach */
+        return NULL;
+    if ((long)(bp = mem_sbrk(size)) == -1)
+        return NULL;
+    heap_grown += size;
+    if (growing_ahead)
+        heap_grown_ahead += size;
+
+    /* Initialize free block header/footer and the epilogue header */
+    PUT(HDRP(bp), PACK(size, 0));         /* free block header */
+    PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+
+    /* Coalesce if the previous block was free */
+    return coalesce(bp);
+}
+
+
+/*
+ * Requires:
+ *   "bp" is the address of a newly freed block.
+ *
+ * Effects:
+ *   Perform boundary tag coalescing.  Returns the address of the coalesced
+ *   block.
+ */
+static void *coalesce(void *bp)
+{
+    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp))) || PREV_BLKP(bp) == bp;
+    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    /* Case 1, left coalesce */
+     if (prev_alloc && !next_alloc)
+    {           
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        delete(NEXT_BLKP(bp));
+        anchorDrop(NEXT_BLKP(bp), (char *)bp + size);
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+    }
+
+    /* Case 2, right coalesce */
+    else if (!prev_alloc && next_alloc)
+    {       
+        anchorDrop(bp, NEXT_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+        bp = PREV_BLKP(bp);
+        delete(bp);
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+    }
+
+    /* Case 3, extend the block in both directions */
+    else if (!prev_alloc && !next_alloc)
+    {       
+        size += GET_SIZE(HDRP(PREV_BLKP(bp))) +
+                GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        delete(PREV_BLKP(bp));
+        delete(NEXT_BLKP(bp));
+        anchorDrop(bp, NEXT_BLKP(NEXT_BLKP(bp)));
+        anchorDrop(NEXT_BLKP(bp), NEXT_BLKP(NEXT_BLKP(bp)));
+        bp = PREV_BLKP(bp);
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+    }
+   
+    add(bp);   
+    anchorBlock(bp);
+    return bp;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Find a fit in the explicit free list for a block with "asize" bytes.  Returns that block's address
+ *   or NULL if no suitable block was found.  If "lowest" is set the whole
+ *   list is searched for the fit at the lowest address instead, which keeps
+ *   long-lived blocks packed at the bottom of the heap.  In real-time
+ *   mode only the first RT_PROBES blocks are examined, and then the
+ *   wilderness.
+ */
+static void *findFit(size_t asize, bool lowest)
+{
+    void *bp, *best = NULL;
+    int probes = 0;
+    /* First fit search */   
+    for (bp = free_listp; GET_ALLOC(HDRP(bp)) == 0; bp = NEXT_FREEP(bp))
+    {
+        if (rt_mode && ++probes > RT_PROBES) {
+            if (best == NULL && (bp = wilderness()) != NULL &&
+                asize <= (size_t)GET_SIZE(HDRP(bp)))
+                best = bp;
+            break;
+        }
+        if (asize <= (size_t)GET_SIZE(HDRP(bp))) {
+            if (!lowest)
+                return bp;
+            if (best == NULL || bp < best)
+                best = bp;
+        }
+    }
+    return best; // NULL if no fit
+}
+
+/*
+ * Requires:
+ *   "align" is a power of two and a multiple of 8.
+ *
+ * Effects:
+ *   Find a free block that can hold a block of "asize" bytes whose payload
+ *   is "align"-aligned, and split off the part in front of that payload as
+ *   its own free block.  Returns the address of the aligned free block, or
+ *   NULL if no suitable block was found.  In real-time mode only the first
+ *   RT_PROBES blocks are examined, and then the wilderness.
+ */
+static void *alignedFit(size_t asize, size_t align)
+{
+    char *bp, *ap;
+    size_t csize;
+    int probes = 0;
+
+    for (bp = free_listp; GET_ALLOC(HDRP(bp)) == 0; bp = NEXT_FREEP(bp))
+    {
+        /* Past the probes the wilderness is tried, and then no more. */
+        if (rt_mode && ++probes > RT_PROBES &&
+            (probes > RT_PROBES + 1 || (bp = wilderness()) == NULL))
+            return NULL;
+        csize = GET_SIZE(HDRP(bp));
+        ap = (char *)(((uintptr_t)bp + align - 1) & ~(uintptr_t)(align - 1));
+        /* The leading fragment must be empty or a block of its own. */
+        if (ap != bp && (size_t)(ap - bp) < MINIMUM)
+            ap = (char *)(((uintptr_t)bp + MINIMUM + align - 1) &
+                ~(uintptr_t)(align - 1));
+        if (ap + asize > bp + csize)
+            continue;
+        if (ap != bp) {
+            /* "bp" keeps its list position as the leading fragment. */
+            PUT(HDRP(bp), PACK(ap - bp, 0));
+            PUT(FTRP(bp), PACK(ap - bp, 0));
+            PUT(HDRP(ap), PACK(csize - (ap - bp), 0));
+            PUT(FTRP(ap), PACK(csize - (ap - bp), 0));
+            add(ap);
+            anchorBlock(ap);
+        }
+        return ap;
+    }
+    return NULL; // No fit
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block that is at least "asize" bytes.
+ *
+ * Effects:
+ *   Place a block of "asize" bytes at the start of the free block "bp" and
+ *   split that block if the remainder would be at least the minimum block
+ *   size.
+ */
+static void place(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+
+    /* If the difference is at least MINIMUM bytes, change the header and footer
+     * info for the allocated block (size = asize, allocated = 1) and
+     * remove the block from the free list.
+     * Then, split the block by:
+     * (1) Changing the header and footer info for the free block created from the
+     * remaining space (size = csize-asize, allocated = 0)
+     * (2) Coalescing the new free block with adjacent free blocks
+    */
+    if ((csize - asize) >= MINIMUM) {
+        PUT(HDRP(bp), PACK(asize, 1));
+        PUT(FTRP(bp), PACK(asize, 1));
+
+	/* Deleting block from free list */
+        delete(bp);
+        bp = NEXT_BLKP(bp);
+
+	/*Splitting the block */
+        PUT(HDRP(bp), PACK(csize-asize, 0));
+        PUT(FTRP(bp), PACK(csize-asize, 0));
+
+	/*Coalescing the newly freed block */
+        coalesce(bp);
+    }
+    /* If the remaining space is not enough for a free block, don't split the block */
+    else {
+        PUT(HDRP(bp), PACK(csize, 1));
+        PUT(FTRP(bp), PACK(csize, 1));
+        delete(bp);
+    }
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block that is at least "asize" bytes.
+ *
+ * Effects:
+ *   Place a block of "asize" bytes at the end of the free block "bp" and
+ *   return its address.  If the remainder would be at least the minimum
+ *   block size, it stays in the free list where "bp" already is, so no list
+ *   update is needed; otherwise the whole block is allocated.
+ */
+static void *placeTail(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+
+    if ((csize - asize) >= MINIMUM) {
+        PUT(HDRP(bp), PACK(csize-asize, 0));
+        PUT(FTRP(bp), PACK(csize-asize, 0));
+        bp = NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK(asize, 1));
+        PUT(FTRP(bp), PACK(asize, 1));
+        anchorBlock(bp);
+    }
+    else {
+        PUT(HDRP(bp), PACK(csize, 1));
+        PUT(FTRP(bp), PACK(csize, 1));
+        delete(bp);
+    }
+    return bp;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Return the last block of the heap if it is free and NULL otherwise.  The
+ *   epilogue sits right at the break, so its footer-side neighbour is found
+ *   without a walk.
+ */
+static void *wilderness(void)
+{
+    void *bp = PREV_BLKP((char *)mem_heap_hi() + 1);
+
+    if (bp == (char *)mem_heap_hi() + 1 || GET_ALLOC(HDRP(bp)))
+        return NULL;
+    return bp;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Check the heap for consistency, printing each problem found, and each
+ *   block as well if "verbose" is nonzero.
+ */
+void mm_checkheap(int verbose)
+{
+    HEAP_LOCK();
+    checkheap(verbose);
+    HEAP_UNLOCK();
+}
+
+/* 
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Perform a minimal check of the heap for consistency. 
+ */
+static void checkheap(int verbose)
+{
+    void *bp, *prologue = heap_listp + DSIZE;
+    struct checkwalk cw = {0, 0, verbose != 0};
+    size_t listfree = 0;
+
+    if (verbose)
+        printf("Heap (%p):\n", heap_listp);
+
+    if ((GET_SIZE(HDRP(prologue)) != MINIMUM) || !GET_ALLOC(HDRP(prologue)))
+        printf("Bad prologue header\n");
+
+    /*
+     * Checks every block and its anchors, on parallel walkers unless the
+     * blocks are printed in order; then that together they tile the heap.
+     */
+    if ((verbose ? mm_heap_walk(checkWalk, &cw, 0) :
+        mm_heap_walk_parallel(checkWalk, &cw, walkThreads())) != 0)
+        return;
+    if (cw.bytes != (size_t)((char *)mem_heap_hi() + 1 - (char *)FIRST_BLKP))
+        printf("Error: the blocks do not cover the heap\n");
+
+    bp = (char *)mem_heap_hi() + 1;
+    if (verbose)
+        printblock(bp);
+    if (GET_SIZE(HDRP(bp)) != 0 || !GET_ALLOC(HDRP(bp)))
+        printf("Bad epilogue header\n");
+
+    /* Checks the free list links; the list ends at the prologue */
+    for (bp = free_listp; !GET_ALLOC(HDRP(bp)); bp = NEXT_FREEP(bp)) {
+        if (PREV_FREEP(bp) == NULL ? bp != free_listp :
+            NEXT_FREEP(PREV_FREEP(bp)) != bp)
+            printf("Error: %p has a bad previous link\n", bp);
+        if (++listfree > cw.heapfree)
+            break;
+    }
+    if (bp != prologue || listfree != cw.heapfree)
+        printf("Not all free blocks are in the free list\n");
+}
+
+/*
+ * Checks one block for checkheap: its tags and links, that a free block
+ * follows an allocated one, and the anchors of the extents from the one
+ * holding its header up to the next block's.  An extent's anchor is the
+ * block if it is the first there, 0 if no header lies in it, and either
+ * for the extent of the epilogue.  Stops the walk if the block runs past
+ * the heap.
+ */
+static int checkWalk(const struct mm_block_info *blk, void *ctx)
+{
+    struct checkwalk *cw = ctx;
+    char *bp = blk->addr;
+    size_t off = bp - heap_listp, next = off + blk->size;
+    size_t e = ANCHOR_EXTENT(off);
+
+    if (cw->verbose)
+        printblock(bp);
+    if ((char *)FTRP(bp) > (char *)mem_heap_hi()) {
+        printf("Error: %p runs past the end of the heap\n", bp);
+        return 1;
+    }
+    checkblock(bp);
+    if (!blk->alloc) {
+        if (!GET_ALLOC(HDRP(PREV_BLKP(bp))))
+            printf("Error: %p was not coalesced with the block before\n",
+                bp);
+        __atomic_add_fetch(&cw->heapfree, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&cw->bytes, blk->size, __ATOMIC_RELAXED);
+
+    if (e < ANCHORS && anchors[e] != off && ((void *)bp == FIRST_BLKP ||
+        ANCHOR_EXTENT((size_t)((char *)PREV_BLKP(bp) - heap_listp)) < e))
+        printf("Bad anchor for extent %zu\n", e);
+    for (e++; e < ANCHORS && e < ANCHOR_EXTENT(next); e++)
+        if (anchors[e] != 0)
+            printf("Bad anchor for extent %zu\n", e);
+    if (e < ANCHORS && e == ANCHOR_EXTENT(next) &&
+        GET_SIZE(HDRP(bp + blk->size)) == 0 &&
+        anchors[e] != 0 && anchors[e] != next)
+        printf("Bad anchor for extent %zu\n", e);
+    return 0;
+}
+
+/* Returns the number of threads a checker walk uses: one per CPU. */
+static int walkThreads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return cpus < 1 ? 1 : (int)MIN(cpus, (long)WALKERS);
+}
+
+/*
+ * printblock - Prints the details of a block in the list.
+ * This function displays previous and next pointers if the block
+ * is marked as free.
+ *
+ * This function takes a block pointer (to a block for examination) as a
+ * parameter.
+ */
+static void printblock(void *bp)
+{
+    int hsize, halloc, fsize, falloc;
+	size_t h,f;
+    /* Basic header and footer information */
+    hsize = GET_SIZE(HDRP(bp));
+    halloc = GET_ALLOC(HDRP(bp));
+    fsize = GET_SIZE(FTRP(bp));
+    falloc = GET_ALLOC(FTRP(bp));
+
+    if (hsize == 0)
+    {
+        printf("%p: end of heap\n", bp);
+        return;
+    }
+   
+    /* Prints out header and footer info if it's an allocated block.
+     * Prints out header and footer info and next and prev info
+     * if it's a free block.
+    */
+	h=hsize;
+	f=fsize;
+	printf("%p: header:[%zu:%c] footer:[%zu:%c]\n",bp,h,(halloc ? 'a' : 'f'),f,(falloc ? 'a' : 'f'));
+}
+
+static void checkblock(void *bp)
+{
+    /* CHecks if the pointers of a free block point to valid addresses */
+    if (!GET_ALLOC(HDRP(bp)) &&
+        ((void *)NEXT_FREEP(bp) < mem_heap_lo() ||
+        (void *)NEXT_FREEP(bp) > mem_heap_hi()))
+        printf("Error: next pointer %p is not within heap bounds, points to invalid address \n"
+                , NEXT_FREEP(bp));
+    if (!GET_ALLOC(HDRP(bp)) && PREV_FREEP(bp) != NULL &&
+        ((void *)PREV_FREEP(bp) < mem_heap_lo() ||
+        (void *)PREV_FREEP(bp) > mem_heap_hi()))
+        printf("Error: prev pointer %p is not within heap bounds, points to invalid address \n"
+                , PREV_FREEP(bp));
+
+    /* Reports if there isn't DSIZE alignment by checking if the block pointer
+     * is divisible by DSIZE.
+    */
+    if ((size_t)bp % 8)
+        printf("Error: %p is not doubleword aligned\n", bp);
+
+    /* Reports if the header does not match the footer */
+    if (GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp)) ||
+        GET_ALLOC(HDRP(bp)) != GET_ALLOC(FTRP(bp)))
+        printf("Error: header does not match footer\n");
+}
+
+
+/*
+ * Inserts a block at the front of the explicit free list
+ */
+static void add(void *bp)
+{
+    NEXT_FREEP(bp) = free_listp;        //Sets next ptr to start of free list
+    PREV_FREEP(free_listp) = bp;        //Sets current's prev to new block
+    PREV_FREEP(bp) = NULL;              // Sets prev pointer to NULL
+    free_listp = bp;                    // Sets start of free list as new block
+}
+
+/*
+ * Removes a block from the free list
+ * If there's a prev block, set the next pointer of this block 
+ * to the next pointer of the current block.
+ * If not, set the next block's previous pointer to the prev 
+ * of the current block.
+ */
+
+static void delete(void *bp)
+{
+    
+    if (PREV_FREEP(bp))
+        NEXT_FREEP(PREV_FREEP(bp)) = NEXT_FREEP(bp);
+    else
+        free_listp = NEXT_FREEP(bp);
+    PREV_FREEP(NEXT_FREEP(bp)) = PREV_FREEP(bp);
+}
+
+/*
+ * Returns the slot in lt_sites for allocation site "site", claiming it (and
+ * forgetting whatever site used it before) if necessary.  A claim bumps the
+ * slot's generation, so deaths of the old site's blocks are not folded in.
+ */
+static struct ltsite *ltSite(uintptr_t site)
+{
+    struct ltsite *ls = &lt_sites[(site * 2654435761u >> 8) % LT_SITES];
+
+    if (ls->site != site) {
+        ls->site = site;
+        ls->avg = 0;
+        ls->samples = 0;
+        ls->gen++;
+    }
+    return ls;
+}
+
+/*
+ * Returns the lt_blocks slot that holds heap offset "off", or the empty slot
+ * where it would be inserted.
+ */
+static struct ltblock *ltSlot(uint32_t off)
+{
+    size_t i = ((off >> 3) * 2654435761u) & (LT_TRACKED - 1);
+
+    while (lt_blocks[i].off != 0 && lt_blocks[i].off != off)
+        i = (i + 1) & (LT_TRACKED - 1);
+    return &lt_blocks[i];
+}
+
+/*
+ * Predicts whether blocks from "site" die young.  A site needs a few
+ * samples before it is trusted; until then its blocks are long-lived.
+ */
+static bool ltPredictShort(uintptr_t site)
+{
+    struct ltsite *ls = ltSite(site);
+
+    return ls->samples >= LT_WARMUP && ls->avg < LT_SHORT;
+}
+
+/*
+ * Records the birth of block "bp" allocated by "site".  Births are dropped
+ * once the table is three quarters full, so sampling never slows down the
+ * probe sequence much.
+ */
+static void ltBirth(void *bp, uintptr_t site)
+{
+    struct ltblock *lb;
+    struct ltsite *ls;
+
+    lt_clock++;
+    if (lt_live >= LT_TRACKED / 4 * 3) {
+        for (lt_live = 0, lb = lt_blocks; lb < lt_blocks + LT_TRACKED; lb++)
+            lt_live += lb->off != 0;
+        if (lt_live >= LT_TRACKED / 4 * 3)
+            return;
+    }
+    lb = ltSlot((char *)bp - heap_listp);
+    if (lb->off == 0)
+        lt_live++;
+    lb->off = (char *)bp - heap_listp;
+    ls = ltSite(site);
+    lb->site = ls - lt_sites;
+    lb->gen = ls->gen;
+    lb->birth = lt_clock;
+}
+
+/*
+ * Records the death of block "bp" and folds its lifetime into the running
+ * average of the site that allocated it, unless another site has claimed
+ * the slot since; the first sample seeds the average.  The slot is emptied
+ * with backward-shift deletion so that no tombstones build up.
+ */
+static void ltDeath(void *bp)
+{
+    struct ltblock *lb = ltSlot((char *)bp - heap_listp);
+    struct ltsite *ls;
+    size_t i, j, k;
+
+    if (lb->off == 0)
+        return;
+    ls = &lt_sites[lb->site];
+    if (ls->gen == lb->gen) {
+        if (ls->samples++ == 0)
+            ls->avg = (long)(lt_clock - lb->birth);
+        else
+            ls->avg += ((long)(lt_clock - lb->birth) - ls->avg) / 8;
+    }
+
+    /* Shift later members of the probe run back into the hole. */
+    i = lb - lt_blocks;
+    for (j = (i + 1) & (LT_TRACKED - 1); lt_blocks[j].off != 0;
+         j = (j + 1) & (LT_TRACKED - 1)) {
+        k = ((lt_blocks[j].off >> 3) * 2654435761u) & (LT_TRACKED - 1);
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            lt_blocks[i] = lt_blocks[j];
+            i = j;
+        }
+    }
+    lt_blocks[i].off = 0;
+    lt_live--;
+}
+
+/*
+ * Carves "size" bytes from the short-lived region, opening a new region
+ * when it is full.  Regions are bump-allocated and never refill a hole,
+ * so a region's blocks drain together and it is recycled as a whole.
+ * Each block is preceded by a double word holding its payload size.
+ * Returns NULL if no region can be created.
+ */
+static void *ltRegionAlloc(size_t size)
+{
+    size_t need = DSIZE + (size + DSIZE - 1) / (DSIZE) * (DSIZE);
+    struct span *sp = lt_region;
+    char *p;
+
+    if (sp == NULL ||
+        sp->bump + need > (size_t)LT_REGION * mem_pagesize()) {
+        if (sp == NULL || sp->live > 0) {
+            /* The full region stays behind until its last block dies. */
+            if ((sp = spanAlloc(LT_REGION, SPAN_SHORT)) == NULL)
+                return NULL;
+            sp->live = 0;
+            lt_region = sp;
+        }
+        sp->bump = 0;
+    }
+    p = sp->region->base + (size_t)sp->first * mem_pagesize() + sp->bump;
+    *(size_t *)p = need - DSIZE;
+    sp->bump += need;
+    sp->live++;
+    return p + DSIZE;
+}
+
+/*
+ * Frees block "bp" of short-lived region "sp".  When the region drains, it
+ * is rewound if it is still being carved, or else purged and returned to
+ * the page heap.
+ */
+static void ltRegionFree(struct span *sp, void *bp)
+{
+    if (lifetime_mode)
+        ltDeath(bp);
+    if (--sp->live > 0)
+        return;
+    if (sp == lt_region) {
+        sp->bump = 0;
+        return;
+    }
+    madvise(sp->region->base + (size_t)sp->first * mem_pagesize(),
+        (size_t)sp->npages * mem_pagesize(), MADV_DONTNEED);
+    sp->purged = true;
+    spanFree(sp);
+}
+
+/*
+ * Carves "size" bytes, a whole number of cache lines, from the calling
+ * thread's MM_NOSHARE region, opening a new region when it is full.  As
+ * with short-lived regions, carving only moves forward, and a region is
+ * recycled once its last block is freed.  The region's first lines hold
+ * the length in lines of the block starting at each line, so that no
+ * payload line carries metadata.  Returns NULL if no region can be
+ * created.
+ */
+static void *nsAlloc(size_t size)
+{
+    size_t len = (size_t)NS_REGION * mem_pagesize();
+    size_t table = (len / CACHELINE + CACHELINE - 1) &
+        ~(size_t)(CACHELINE - 1);
+    struct span *sp = noshare_region;
+    uint8_t *base;
+
+    if (noshare_gen != heap_generation) {
+        /* First block of this thread, or a region of an old heap. */
+        pthread_once(&noshare_once, nsKey);
+        noshare_gen = heap_generation;
+        sp = NULL;
+    }
+    if (sp == NULL || sp->bump + size > len) {
+        if (sp == NULL || sp->live > 0) {
+            /* The full region stays behind until its last block is freed. */
+            if (sp != NULL)
+                sp->carving = false;
+            if ((sp = spanAlloc(NS_REGION, SPAN_NOSHARE)) == NULL) {
+                noshare_region = NULL;
+                return NULL;
+            }
+            sp->live = 0;
+            sp->carving = true;
+            noshare_region = sp;
+            pthread_setspecific(noshare_key, sp);
+        }
+        sp->bump = 0;
+    }
+    if (sp->bump == 0)
+        sp->bump = table;
+    base = (uint8_t *)sp->region->base + (size_t)sp->first * mem_pagesize();
+    base[sp->bump / CACHELINE] = size / CACHELINE;
+    sp->bump += size;
+    sp->live++;
+    return base + sp->bump - size;
+}
+
+/* Returns the payload size of block "bp" of MM_NOSHARE region "sp". */
+static size_t nsSize(struct span *sp, void *bp)
+{
+    uint8_t *base = (uint8_t *)sp->region->base +
+        (size_t)sp->first * mem_pagesize();
+
+    return (size_t)base[((uint8_t *)bp - base) / CACHELINE] * CACHELINE;
+}
+
+/*
+ * Frees a block of MM_NOSHARE region "sp".  When the region drains, it
+ * is rewound if a thread is still carving it, or else returned to the page
+ * heap.
+ */
+static void nsFree(struct span *sp)
+{
+    if (--sp->live > 0)
+        return;
+    if (sp->carving)
+        sp->bump = 0;
+    else
+        spanFree(sp);
+}
+
+/* Creates the key whose destructor gives up a thread's region. */
+static void nsKey(void)
+{
+    pthread_key_create(&noshare_key, nsExit);
+}
+
+/* Gives up the MM_NOSHARE region of an exiting thread. */
+static void nsExit(void *arg)
+{
+    struct span *sp = arg;
+
+    if (noshare_gen != heap_generation || noshare_region != sp)
+        return;
+    HEAP_LOCK();
+    sp->carving = false;
+    if (sp->live == 0)
+        spanFree(sp);
+    HEAP_UNLOCK();
+}
+
+/*
+ * Records "bp", whose header was just written, as the anchor of its extent
+ * if no block before it has its header there.  A split or a new block
+ * touches this one anchor whatever its size.
+ */
+static void anchorBlock(void *bp)
+{
+    uint32_t off = (char *)bp - heap_listp;
+    uint32_t *a = &anchors[ANCHOR_EXTENT(off)];
+
+    if (*a == 0 || *a > off)
+        *a = off;
+}
+
+/*
+ * Forgets block "bp", whose header was just absorbed by a merge; "next" is
+ * the first block after the merged one.  If "bp" anchored its extent, the
+ * anchor moves on to "next", or is cleared if "next" lies further on.
+ */
+static void anchorDrop(void *bp, void *next)
+{
+    uint32_t off = (char *)bp - heap_listp, noff = (char *)next - heap_listp;
+    size_t e = ANCHOR_EXTENT(off);
+
+    if (anchors[e] == off)
+        anchors[e] = ANCHOR_EXTENT(noff) == e ? noff : 0;
+}
+
+/*
+ * Recomputes every anchor with one walk of the heap, after a pass that
+ * moves or merges blocks throughout it.
+ */
+static void anchorRebuild(void)
+{
+    void *bp;
+
+    memset(anchors, 0, sizeof(anchors));
+    for (bp = FIRST_BLKP; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+        anchorBlock(bp);
+}
+
+/*
+ * Thread body of mm_heap_walk_parallel: visits the blocks whose headers lie
+ * in [lo, hi), starting from the first anchor at or after "lo".
+ */
+static void *walkExtents(void *arg)
+{
+    struct walkpart *wp = arg;
+    struct mm_block_info info;
+    size_t e;
+    void *bp;
+
+    /* Extents without an anchor lie inside a block that starts earlier. */
+    for (e = wp->lo >> EXTENT_SHIFT; e < ANCHORS && anchors[e] == 0 &&
+         (e << EXTENT_SHIFT) < MIN(wp->hi, mem_heapsize()); e++)
+        ;
+    if (e == ANCHORS || anchors[e] == 0)
+        return NULL;
+    bp = wp->lo == 0 ? FIRST_BLKP : heap_listp + anchors[e];
+    for (; GET_SIZE(HDRP(bp)) > 0 && !*wp->stop; bp = NEXT_BLKP(bp)) {
+        if ((size_t)((char *)HDRP(bp) - heap_listp) >= wp->hi)
+            break;
+        info.addr = bp;
+        info.size = GET_SIZE(HDRP(bp));
+        info.alloc = GET_ALLOC(HDRP(bp));
+        info.arena = info.alloc ? GET_ARENA(HDRP(bp)) : 0;
+        if ((wp->ret = wp->fn(&info, wp->ctx)) != 0) {
+            *wp->stop = 1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns whether "bp" lies in the memlib heap, as opposed to a mapping of
+ * its own.
+ */
+static bool inHeap(void *bp)
+{
+    return bp >= mem_heap_lo() && bp <= mem_heap_hi();
+}
+
+/*
+ * Allocates "size" bytes in a mapping of their own whose payload ends,
+ * up to the double-word rounding, against a PROT_NONE guard page.  The
+ * mapping starts with its link on the live list, the header holds the
+ * block size as usual, and the word in front of it holds the mapping's
+ * length.  Returns NULL if the mapping fails.
+ */
+static void *guardAlloc(size_t size)
+{
+    size_t page = mem_pagesize();
+    size_t asize = (size + 7) & ~(size_t)7;
+    size_t len = (asize + DSIZE + sizeof(struct gmap) + page - 1) / page *
+        page + page;
+    struct gmap *gm;
+    char *bp;
+
+    gm = mmap(NULL, len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (gm == MAP_FAILED)
+        return NULL;
+    if (mprotect((char *)gm + len - page, page, PROT_NONE) < 0) {
+        munmap(gm, len);
+        return NULL;
+    }
+    gm->len = len;
+    gm->prev = NULL;
+    if ((gm->next = guard_live) != NULL)
+        guard_live->prev = gm;
+    guard_live = gm;
+    bp = gm->bp = (char *)gm + len - page - asize;
+    PUT(HDRP(bp), PACK(asize + DSIZE, 1));
+    *(size_t *)(bp - DSIZE) = len;
+    return bp;
+}
+
+/*
+ * Frees a block made by guardAlloc: the whole mapping becomes inaccessible
+ * and joins the quarantine ring, and the oldest mapping in the ring is
+ * unmapped to make room.
+ */
+static void guardFree(void *bp)
+{
+    size_t len = *(size_t *)((char *)bp - DSIZE);
+    char *base = (char *)bp + GET_SIZE(HDRP(bp)) - DSIZE + mem_pagesize() -
+        len;
+    struct gmap *gm = (struct gmap *)base;
+
+    if (gm->prev != NULL)
+        gm->prev->next = gm->next;
+    else
+        guard_live = gm->next;
+    if (gm->next != NULL)
+        gm->next->prev = gm->prev;
+    mprotect(base, len, PROT_NONE);
+    if (guard_ring[guard_next].base != NULL)
+        munmap(guard_ring[guard_next].base, guard_ring[guard_next].len);
+    guard_ring[guard_next].base = base;
+    guard_ring[guard_next].len = len;
+    guard_next = (guard_next + 1) % GUARD_QUARANTINE;
+}
+
+/*
+ * Releases the "n" oldest blocks of the free quarantine as one batch.  In
+ * DEBUG builds a block whose poison was overwritten while it sat in the
+ * ring is reported as written after free.
+ */
+static void drainQuarantine(size_t n)
+{
+    void *v[QUARANTINE_MAX];
+    size_t i;
+#ifdef DEBUG
+    unsigned char *p;
+#endif
+
+    for (i = 0; i < n; i++) {
+        v[i] = quarantine[quarantine_head];
+        quarantine_head = (quarantine_head + 1) % quarantine_size;
+#ifdef DEBUG
+        for (p = v[i]; p < (unsigned char *)FTRP(v[i]); p++)
+            if (*p != POISON) {
+                printf("Error: %p written after free\n", v[i]);
+                break;
+            }
+#endif
+    }
+    quarantine_len -= n;
+    qsort(v, n, sizeof(v[0]), byAddress);
+    freeBatch(v, n);
+}
+
+/*
+ * Frees the "n" allocated blocks of "v", which is sorted by address.  Runs
+ * of blocks that are adjacent in the heap become one free block first, so
+ * each run costs one coalesce with its outer neighbours.
+ */
+static void freeBatch(void **v, size_t n)
+{
+    size_t i, j, k, size;
+    void *bp;
+
+    for (i = 0; i < n; i = j) {
+        bp = v[i];
+        size = GET_SIZE(HDRP(bp));
+        for (j = i + 1; j < n && v[j] == (char *)bp + size; j++)
+            size += GET_SIZE(HDRP(v[j]));
+        for (k = i + 1; k < j; k++)
+            anchorDrop(v[k], (char *)bp + size);
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+        bp = coalesce(bp);
+        if (purge_min > 0 && (size_t)GET_SIZE(HDRP(bp)) >= purge_min)
+            purgeFree(bp);
+    }
+}
+
+/*
+ * Gives the whole pages inside block "bp", free or about to be, back to
+ * the system, all but its free-list links and boundary tags.  Returns the
+ * bytes purged.
+ */
+static size_t purgeFree(void *bp)
+{
+    size_t page = mem_pagesize();
+    uintptr_t lo = ((uintptr_t)bp + DSIZE + WSIZE + page - 1) & ~(page - 1);
+    uintptr_t hi = (uintptr_t)FTRP(bp) & ~(page - 1);
+
+    if (hi <= lo || madvise((void *)lo, hi - lo, MADV_DONTNEED) != 0)
+        return 0;
+    return hi - lo;
+}
+
+/*
+ * The system pressure source.  Either half of the sample may be missing:
+ * without PSI the stall share is 0, and without a cgroup limit the limit
+ * is 0.  Fails only if both are missing.
+ */
+static int pressureRead(struct mm_pressure_sample *ps, void *ctx)
+{
+    char line[512], dir[512 + sizeof(CGROUP_ROOT)], *path;
+    bool psi = false, cgroup = false;
+    FILE *f;
+
+    (void)ctx;
+    if ((f = fopen(PSI_PATH, "r")) != NULL) {
+        psi = fscanf(f, "some avg10=%lf", &ps->some_avg10) == 1;
+        fclose(f);
+    }
+
+    /* The cgroup v2 entry of /proc/self/cgroup reads "0::/path". */
+    if ((f = fopen("/proc/self/cgroup", "r")) != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (strncmp(line, "0::", 3) != 0)
+                continue;
+            path = line + 3;
+            path[strcspn(path, "\n")] = '\0';
+            snprintf(dir, sizeof(dir), "%s%s", CGROUP_ROOT, path);
+            ps->limit = pressureFile(dir, "memory.max");
+            ps->current = pressureFile(dir, "memory.current");
+            cgroup = ps->limit > 0;
+            break;
+        }
+        fclose(f);
+    }
+    return psi || cgroup ? 0 : -1;
+}
+
+/*
+ * Returns the number in file "name" of cgroup directory "dir", or 0 if it
+ * cannot be read or reads "max".
+ */
+static size_t pressureFile(const char *dir, const char *name)
+{
+    char path[1024];
+    unsigned long long v = 0;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((f = fopen(path, "r")) == NULL)
+        return 0;
+    if (fscanf(f, "%llu", &v) != 1)
+        v = 0;
+    fclose(f);
+    return (size_t)v;
+}
+
+/*
+ * Body of the pressure monitor: polls until mm_pressure_monitor(0).
+ */
+static void *pressureMonitor(void *arg)
+{
+    struct timespec ts;
+    unsigned ms;
+
+    (void)arg;
+    pthread_mutex_lock(&pressure_lock);
+    while ((ms = pressure_ms) != 0) {
+        pthread_mutex_unlock(&pressure_lock);
+        mm_pressure_poll();
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&pressure_lock);
+        if (pressure_ms == ms)
+            pthread_cond_timedwait(&pressure_wake, &pressure_lock, &ts);
+    }
+    pthread_mutex_unlock(&pressure_lock);
+    return NULL;
+}
+
+/*
+ * Charges "n" bytes, negative for frees, to arena "a" in the calling
+ * thread's deltas, publishing them once they pass ARENA_SLOP, and handles
+ * the arena crossing its soft limit in either direction.
+ */
+static void arenaCharge(int a, long n)
+{
+    long used;
+
+    if (arena_gen != heap_generation) {
+        /* First charge of this thread, or charges from an old heap. */
+        pthread_once(&arena_once, arenaKey);
+        pthread_setspecific(arena_key, arena_delta);
+        memset(arena_delta, 0, sizeof(arena_delta));
+        arena_gen = heap_generation;
+    }
+    arena_delta[a] += n;
+    if (arena_delta[a] > ARENA_SLOP || arena_delta[a] < -ARENA_SLOP) {
+        __atomic_add_fetch(&arena_live[a], arena_delta[a], __ATOMIC_RELAXED);
+        arena_delta[a] = 0;
+    }
+
+    if (arena_soft[a] == 0)
+        return;
+    used = arenaUsage(a);
+    if (used <= (long)arena_soft[a])
+        arena_over[a] = false;
+    else if (n > 0 && !arena_over[a]) {
+        arena_over[a] = true;
+        arenaPurge(a);
+        if (arena_fn[a] != NULL)
+            arena_fn[a](a, used, arena_soft[a], arena_ctx[a]);
+    }
+}
+
+/*
+ * Returns the published usage of arena "a" plus the calling thread's
+ * unpublished charges.
+ */
+static long arenaUsage(int a)
+{
+    return __atomic_load_n(&arena_live[a], __ATOMIC_RELAXED) +
+        (arena_gen == heap_generation ? arena_delta[a] : 0);
+}
+
+/* Creates the key whose destructor publishes a thread's charges. */
+static void arenaKey(void)
+{
+    pthread_key_create(&arena_key, arenaExit);
+}
+
+/* Publishes the charges of an exiting thread. */
+static void arenaExit(void *arg)
+{
+    long *delta = arg;
+    int a;
+
+    if (arena_gen != heap_generation)
+        return;
+    for (a = 0; a < ARENAS; a++)
+        __atomic_add_fetch(&arena_live[a], delta[a], __ATOMIC_RELAXED);
+}
+
+/*
+ * Gives back the memory arena "a" let go of: its blocks in the free
+ * quarantine are released with their pages purged, keeping the order of
+ * the rest, and for arena 0, which owns them, so are the free spans.
+ */
+static void arenaPurge(int a)
+{
+    void *v[QUARANTINE_MAX], *bp;
+    size_t i, n = 0, kept = 0;
+
+    for (i = 0; i < quarantine_len; i++) {
+        bp = quarantine[(quarantine_head + i) % quarantine_size];
+        if (GET_ARENA(HDRP(bp)) == a) {
+            purgeFree(bp);
+            v[n++] = bp;
+        }
+        else
+            quarantine[(quarantine_head + kept++) % quarantine_size] = bp;
+    }
+    quarantine_len = kept;
+    qsort(v, n, sizeof(v[0]), byAddress);
+    freeBatch(v, n);
+    if (a == 0)
+        mm_span_purge();
+}
+
+/*
+ * Body of the grow-ahead thread: runs until mm_set_grow_ahead(0).
+ */
+static void *growAhead(void *arg)
+{
+    struct timespec ts;
+    size_t need, have, step;
+    uintptr_t lo = 0, hi = 0;
+    unsigned ms;
+    char *bp;
+
+    (void)arg;
+    pthread_mutex_lock(&grow_lock);
+    while ((ms = grow_ms) != 0) {
+        pthread_mutex_unlock(&grow_lock);
+
+        pthread_mutex_lock(&heap_lock);
+        need = MIN(grow_demand * GROW_HORIZON, (size_t)GROW_MAX);
+        grow_demand = 0;
+        bp = wilderness();
+        have = bp != NULL ? GET_SIZE(HDRP(bp)) : 0;
+        step = need > have ? MAX(need - have, (size_t)GROW_MIN) : 0;
+        growing_ahead = true;
+        if (step > 0 && (bp = extendHeap(step / WSIZE)) != NULL) {
+            hi = (uintptr_t)mem_heap_hi() + 1;
+            lo = (hi - step) & ~(mem_pagesize() - 1);
+        }
+        growing_ahead = false;
+        pthread_mutex_unlock(&heap_lock);
+
+        /* Populating writes no data, so requests may use the pages. */
+        if (hi > lo) {
+            madvise((void *)lo, hi - lo, MADV_POPULATE_WRITE);
+            lo = hi = 0;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&grow_lock);
+        if (grow_ms == ms)
+            pthread_cond_timedwait(&grow_wake, &grow_lock, &ts);
+    }
+    pthread_mutex_unlock(&grow_lock);
+    return NULL;
+}
+
+/*
+ * Returns the epoch record of the calling thread, claiming a free one on
+ * first use, or NULL if all are taken.
+ */
+static struct ethread *epochSelf(void)
+{
+    int i, free;
+
+    if (epoch_self != NULL)
+        return epoch_self;
+    pthread_once(&epoch_once, epochKey);
+    for (i = 0; i < EPOCH_THREADS; i++) {
+        free = 0;
+        if (__atomic_compare_exchange_n(&epoch_threads[i].claimed, &free, 1,
+            false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            epoch_self = &epoch_threads[i];
+            pthread_setspecific(epoch_key, epoch_self);
+            return epoch_self;
+        }
+    }
+    return NULL;
+}
+
+/* Creates the key whose destructor frees a thread's epoch record. */
+static void epochKey(void)
+{
+    pthread_key_create(&epoch_key, epochExit);
+}
+
+/*
+ * Frees the epoch record of an exiting thread.  Its bags join the orphans,
+ * each chunk stamped with the epoch of its bag, for whichever thread next
+ * retires a block to release.
+ */
+static void epochExit(void *arg)
+{
+    struct ethread *et = arg;
+    struct echunk *c, *next;
+    int i;
+
+    pthread_mutex_lock(&epoch_lock);
+    for (i = 0; i < 3; i++) {
+        for (c = et->bag[i]; c != NULL; c = next) {
+            next = c->next;
+            c->epoch = et->bag_epoch[i];
+            c->next = epoch_orphans;
+            __atomic_store_n(&epoch_orphans, c, __ATOMIC_RELAXED);
+        }
+        et->bag[i] = NULL;
+        et->nbag[i] = 0;
+    }
+    pthread_mutex_unlock(&epoch_lock);
+    et->depth = 0;
+    __atomic_store_n(&et->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&et->claimed, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Moves the global epoch from "e" to "e" + 1 if every thread inside a
+ * section entered it during "e".  Returns whether the epoch moved, by
+ * this thread or another.
+ */
+static bool epochAdvance(uint64_t e)
+{
+    uint64_t seen = e;
+    int i;
+
+    for (i = 0; i < EPOCH_THREADS; i++) {
+        seen = __atomic_load_n(&epoch_threads[i].epoch, __ATOMIC_SEQ_CST);
+        if (seen != 0 && seen != e)
+            return false;
+    }
+    seen = e;
+    return __atomic_compare_exchange_n(&epoch_global, &seen, e + 1, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) || seen > e;
+}
+
+/*
+ * Releases bag "i" of "et", one sorted batch per chunk, under the heap
+ * lock.
+ */
+static void epochRelease(struct ethread *et, int i)
+{
+    struct echunk *c;
+
+    HEAP_LOCK();
+    for (c = et->bag[i]; c != NULL; c = c->next)
+        freeSorted(c->v, c->n);
+    HEAP_UNLOCK();
+    epochFree(et->bag[i]);
+    et->bag[i] = NULL;
+    et->nbag[i] = 0;
+}
+
+/*
+ * Releases the orphaned chunks whose epoch is two steps behind "e", under
+ * the heap lock.
+ */
+static void epochOrphans(uint64_t e)
+{
+    struct echunk *c, *next, *ready = NULL, **pp;
+
+    pthread_mutex_lock(&epoch_lock);
+    for (pp = &epoch_orphans; (c = *pp) != NULL; ) {
+        if (c->epoch + 2 <= e) {
+            __atomic_store_n(pp, c->next, __ATOMIC_RELAXED);
+            c->next = ready;
+            ready = c;
+        }
+        else
+            pp = &c->next;
+    }
+    pthread_mutex_unlock(&epoch_lock);
+    if (ready == NULL)
+        return;
+    HEAP_LOCK();
+    for (c = ready; c != NULL; c = next) {
+        next = c->next;
+        freeSorted(c->v, c->n);
+    }
+    HEAP_UNLOCK();
+    epochFree(ready);
+}
+
+/*
+ * Returns the chunks chained from "c" to the spare chunks, dropping the
+ * blocks they recorded.
+ */
+static void epochFree(struct echunk *c)
+{
+    struct echunk *next;
+
+    pthread_mutex_lock(&epoch_lock);
+    for (; c != NULL; c = next) {
+        next = c->next;
+        c->next = epoch_spare;
+        epoch_spare = c;
+    }
+    pthread_mutex_unlock(&epoch_lock);
+}
+
+/*
+ * Frees the "n" blocks of "v", reordering "v".  Foreign blocks are freed
+ * one at a time; heap blocks are sorted and freed as one batch, so that
+ * neighbours merge once.
+ */
+static void freeSorted(void **v, size_t n)
+{
+    size_t i, m = 0;
+
+    for (i = 0; i < n; i++) {
+        if (freeForeign(v[i]))
+            continue;
+        arenaCharge(GET_ARENA(HDRP(v[i])), -(long)GET_SIZE(HDRP(v[i])));
+        if (lifetime_mode)
+            ltDeath(v[i]);
+        if (GROWER(v[i])->bp == v[i])
+            GROWER(v[i])->bp = NULL;
+        v[m++] = v[i];
+    }
+    qsort(v, m, sizeof(v[0]), byAddress);
+    freeBatch(v, m);
+}
+
+/*
+ * Starts the reclaimer thread.
+ */
+static void asyncStart(void)
+{
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    pthread_key_create(&async_key, asyncExit);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    async_running = pthread_create(&tid, &attr, asyncReclaim, NULL) == 0;
+    pthread_attr_destroy(&attr);
+}
+
+/* Hands the buffer of an exiting thread to the reclaimer. */
+static void asyncExit(void *arg)
+{
+    asyncHand(arg);
+}
+
+/*
+ * Queues buffer "b", which the calling thread stops filling, for the
+ * reclaimer.
+ */
+static void asyncHand(struct abatch *b)
+{
+    async_self = NULL;
+    pthread_setspecific(async_key, NULL);
+    pthread_mutex_lock(&async_lock);
+    b->next = async_queue;
+    async_queue = b;
+    async_busy++;
+    pthread_cond_signal(&async_work);
+    pthread_mutex_unlock(&async_lock);
+}
+
+/*
+ * Body of the reclaimer thread: frees queued buffers under the heap lock
+ * and keeps them as spares.  A buffer filled before the last mm_init is
+ * dropped, since its blocks are gone.
+ */
+static void *asyncReclaim(void *arg)
+{
+    struct abatch *b;
+
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&async_lock);
+        while ((b = async_queue) == NULL)
+            pthread_cond_wait(&async_work, &async_lock);
+        async_queue = b->next;
+        pthread_mutex_unlock(&async_lock);
+
+        pthread_mutex_lock(&heap_lock);
+        if (b->generation == heap_generation)
+            freeSorted(b->v, b->n);
+        pthread_mutex_unlock(&heap_lock);
+
+        pthread_mutex_lock(&async_lock);
+        b->next = async_spare;
+        async_spare = b;
+        if (--async_busy == 0)
+            pthread_cond_broadcast(&async_idle);
+        pthread_mutex_unlock(&async_lock);
+    }
+    return NULL;
+}
+
+/* qsort comparator ordering block pointers by address */
+static int byAddress(const void *a, const void *b)
+{
+    const char *x = *(void * const *)a, *y = *(void * const *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Returns whether "bp" was made by guardAlloc.
+ */
+static bool isGuarded(void *bp)
+{
+    return guard_mode && !inHeap(bp) && !inMesh(bp) && lmapOf(bp) == NULL;
+}
+
+/*
+ * Returns the payload size of a block that is not managed with boundary
+ * tags, or 0 if "bp" is an ordinary heap block.
+ */
+static size_t foreignSize(void *bp)
+{
+    struct span *sp;
+    struct lmap *m;
+    struct bzone *z;
+
+    if (inMesh(bp))
+        return mesh_sizes[mesh_phys[mesh_map[((char *)bp - mesh_base) /
+            mem_pagesize()]].sclass];
+    if (isGuarded(bp))
+        return GET_SIZE(HDRP(bp)) - DSIZE;
+    if ((z = buddyOf(bp)) != NULL)
+        return (size_t)1 << z->order[((char *)bp - z->base) >> buddy_min];
+    if ((m = lmapOf(bp)) != NULL)
+        return m->len - LMAP_HDR;
+    if ((sp = pagemapSpan(bp)) != NULL && sp->state == SPAN_OOB)
+        return oobSize(sp->meta, bp);
+    if (sp != NULL && sp->state == SPAN_SHORT)
+        return *(size_t *)((char *)bp - DSIZE);
+    if (sp != NULL && sp->state == SPAN_NOSHARE)
+        return nsSize(sp, bp);
+    if ((sp = spanOf(bp)) != NULL)
+        return (size_t)sp->npages * mem_pagesize();
+    return 0;
+}
+
+/*
+ * Frees "bp" if it is not managed with boundary tags and returns whether
+ * it did.
+ */
+static bool freeForeign(void *bp)
+{
+    struct span *sp;
+    struct lmap *m;
+    struct bzone *z;
+
+    if (inMesh(bp))
+        meshFree(bp);
+    else if (isGuarded(bp))
+        guardFree(bp);
+    else if ((z = buddyOf(bp)) != NULL)
+        buddyFree(z, bp);
+    else if ((m = lmapOf(bp)) != NULL)
+        lmapFree(m);
+    else if ((sp = pagemapSpan(bp)) != NULL && sp->state == SPAN_OOB)
+        oobFree(sp->meta, bp);
+    else if (sp != NULL && sp->state == SPAN_SHORT)
+        ltRegionFree(sp, bp);
+    else if (sp != NULL && sp->state == SPAN_NOSHARE)
+        nsFree(sp);
+    else if ((sp = spanOf(bp)) != NULL)
+        spanFree(sp);
+    else
+        return false;
+    return true;
+}
+
+/* Bit operations on the free bitmap of order "k" of zone "z" */
+#define BUDDY_BIT(k, i)   (buddy_base[(k) - buddy_min] + (i))
+#define BUDDY_TEST(z, k, i)  ((z)->free[BUDDY_BIT(k, i) / 64] >> (BUDDY_BIT(k, i) % 64) & 1)
+#define BUDDY_SET(z, k, i)   ((z)->free[BUDDY_BIT(k, i) / 64] |= (uint64_t)1 << (BUDDY_BIT(k, i) % 64))
+#define BUDDY_CLEAR(z, k, i) ((z)->free[BUDDY_BIT(k, i) / 64] &= ~((uint64_t)1 << (BUDDY_BIT(k, i) % 64)))
+
+/*
+ * Returns the order of the buddy blocks that serve "size" bytes, or 0 if
+ * the size is out of range or would leave more than an eighth of its
+ * block unused.
+ */
+static int buddyOrder(size_t size)
+{
+    int k = size <= (size_t)1 << buddy_min ? buddy_min :
+        (int)(8 * sizeof(size_t)) - __builtin_clzl(size - 1);
+
+    if (k > buddy_max || size < ((size_t)1 << k) - ((size_t)1 << k >> 3))
+        return 0;
+    return k;
+}
+
+/*
+ * Allocates a buddy block of order "k" from the first zone that has room,
+ * adding a zone if none does.  Returns NULL if no zone can be added.
+ */
+static void *buddyAlloc(int k)
+{
+    size_t len = (size_t)1 << buddy_top;
+    struct bzone *z;
+    char *base;
+    void *bp;
+
+    for (z = buddy_zones; z != NULL; z = z->next)
+        if ((bp = buddyTake(z, k)) != NULL)
+            return bp;
+
+    /* The zone is aligned to its size and its bookkeeping follows it. */
+    base = allocate(len + sizeof(*z), FLAG_HEAP | MM_NOCACHE | MM_LONGLIVED |
+        MM_LG_ALIGN(buddy_top), 0);
+    if (base == NULL)
+        return NULL;
+    z = (struct bzone *)(base + len);
+    z->base = base;
+    memset(z->free, 0, sizeof(z->free));
+    BUDDY_SET(z, buddy_top, 0);
+    if (pagemapSet(base, len, (void *)((uintptr_t)z | PM_BUDDY)) < 0) {
+        mm_free(base);
+        return NULL;
+    }
+    z->prev = NULL;
+    z->next = buddy_zones;
+    if (buddy_zones != NULL)
+        buddy_zones->prev = z;
+    buddy_zones = z;
+    return buddyTake(z, k);
+}
+
+/*
+ * Allocates a buddy block of order "k" from zone "z", or returns NULL if
+ * the zone has no free block that large.
+ */
+static void *buddyTake(struct bzone *z, int k)
+{
+    int j;
+    size_t i, bit, end;
+
+    /* Take a free block from the smallest order that has one. */
+    for (j = k; j <= buddy_top; j++) {
+        end = buddy_base[j - buddy_min] + ((size_t)1 << (buddy_top - j));
+        for (bit = buddy_base[j - buddy_min]; bit < end; bit = (bit | 63) + 1)
+            if (z->free[bit / 64] >> (bit % 64) != 0)
+                break;
+        if (bit < end) {
+            bit += __builtin_ctzl(z->free[bit / 64] >> (bit % 64));
+            if (bit < end)
+                break;
+        }
+    }
+    if (j > buddy_top)
+        return NULL;
+    i = bit - buddy_base[j - buddy_min];
+    BUDDY_CLEAR(z, j, i);
+
+    /* Split it down to order k, freeing the upper halves. */
+    for (; j > k; j--) {
+        i *= 2;
+        BUDDY_SET(z, j - 1, i + 1);
+    }
+    z->order[(i << k) >> buddy_min] = k;
+    return z->base + (i << k);
+}
+
+/*
+ * Frees block "bp" of buddy zone "z", merging it with its buddy for as
+ * long as the buddy is free too.  The zone moves to the front of the list
+ * so that the next allocation finds the room, and a zone that drains is
+ * given back to the heap unless it is the only one.
+ */
+static void buddyFree(struct bzone *z, void *bp)
+{
+    size_t off = (char *)bp - z->base;
+    int k = z->order[off >> buddy_min];
+    size_t i = off >> k;
+
+    for (; k < buddy_top && BUDDY_TEST(z, k, i ^ 1); k++, i >>= 1)
+        BUDDY_CLEAR(z, k, i ^ 1);
+    BUDDY_SET(z, k, i);
+
+    if (z != buddy_zones || (k == buddy_top && z->next != NULL)) {
+        if (z->prev != NULL)
+            z->prev->next = z->next;
+        else
+            buddy_zones = z->next;
+        if (z->next != NULL)
+            z->next->prev = z->prev;
+        if (k == buddy_top) {
+            pagemapSet(z->base, (size_t)1 << buddy_top, NULL);
+            mm_free(z->base);
+            return;
+        }
+        z->prev = NULL;
+        z->next = buddy_zones;
+        buddy_zones->prev = z;
+        buddy_zones = z;
+    }
+}
+
+/*
+ * Returns the buddy zone that "bp" lies in, or NULL.
+ */
+static struct bzone *buddyOf(void *bp)
+{
+    uintptr_t owner = (uintptr_t)pagemapGet(bp);
+
+    if (!(owner & PM_BUDDY))
+        return NULL;
+    return (struct bzone *)(owner & ~(uintptr_t)PM_BUDDY);
+}
+
+/*
+ * Returns the order of the block of buddy zone "z" that starts at offset
+ * "off" and sets "*used" to whether it is allocated.
+ */
+static int buddyBlock(struct bzone *z, size_t off, bool *used)
+{
+    int k;
+
+    for (k = buddy_min; k <= buddy_top && (off & (((size_t)1 << k) - 1)) == 0;
+         k++)
+        if (BUDDY_TEST(z, k, off >> k)) {
+            *used = false;
+            return k;
+        }
+    *used = true;
+    return z->order[off >> buddy_min];
+}
+
+/*
+ * Returns a span of "npages" pages marked "state", taken from the
+ * smallest free span that fits, or from a new region carved from the heap
+ * if none does.  Returns NULL if the heap cannot supply a region.
+ */
+static struct span *spanAlloc(size_t npages, int state)
+{
+    size_t page = mem_pagesize(), n, hdr;
+    struct span *sp = NULL, *rest;
+    struct region *rg;
+    int b;
+
+    /* Exact bins first, then the best fit among the large spans. */
+    for (b = MIN(npages, (size_t)SPAN_BINS - 1); b < SPAN_BINS - 1; b++)
+        if ((sp = span_bins[b]) != NULL)
+            break;
+    if (sp == NULL)
+        for (rest = span_bins[SPAN_BINS - 1]; rest != NULL; rest = rest->next)
+            if (rest->npages >= npages &&
+                (sp == NULL || rest->npages < sp->npages))
+                sp = rest;
+
+    if (sp == NULL) {
+        /*
+         * Carve a new region, its header pages first.  They describe every
+         * page, their own included, so grow them until they cover that.
+         */
+        for (hdr = 1; ; hdr = (sizeof(*rg) + n * sizeof(struct span) +
+             page - 1) / page) {
+            n = MAX(npages + hdr, (size_t)REGION_PAGES);
+            if (sizeof(*rg) + n * sizeof(struct span) <= hdr * page)
+                break;
+        }
+        rg = allocate(n * page, FLAG_HEAP | MM_LONGLIVED | MM_NOCACHE |
+            MM_LG_ALIGN(__builtin_ctzl(page)), 0);
+        if (rg == NULL)
+            return NULL;
+        memset(rg, 0, hdr * page);
+        rg->base = (char *)rg;
+        rg->npages = n;
+        rg->hdrpages = hdr;
+        rg->next = regions;
+        regions = rg;
+        sp = &rg->spans[hdr];
+        sp->first = hdr;
+        sp->npages = n - hdr;
+        sp->region = rg;
+        sp->purged = false;
+    }
+    else
+        spanRemove(sp);
+
+    /* Return the tail to the bins. */
+    if (sp->npages > npages) {
+        rest = &sp->region->spans[sp->first + npages];
+        rest->first = sp->first + npages;
+        rest->npages = sp->npages - npages;
+        rest->region = sp->region;
+        rest->purged = sp->purged;
+        rest->state = SPAN_FREE;
+        spanMark(rest);
+        spanInsert(rest);
+        sp->npages = npages;
+    }
+    sp->state = state;
+    sp->purged = false;
+    spanMark(sp);
+    if (pagemapSet(sp->region->base + (size_t)sp->first * page,
+        npages * page, sp) < 0) {
+        spanFree(sp);
+        return NULL;
+    }
+    return sp;
+}
+
+/*
+ * Frees span "sp", merging it with free neighbours in its region.  A
+ * region that becomes entirely free goes back to the heap.
+ */
+static void spanFree(struct span *sp)
+{
+    struct region *rg = sp->region, **rp;
+    struct span *nb;
+
+    pagemapSet(rg->base + (size_t)sp->first * mem_pagesize(),
+        (size_t)sp->npages * mem_pagesize(), NULL);
+    sp->state = SPAN_FREE;
+    if (sp->first > rg->hdrpages) {
+        nb = &rg->spans[rg->spans[sp->first - 1].first];
+        if (nb->state == SPAN_FREE) {
+            spanRemove(nb);
+            nb->npages += sp->npages;
+            nb->purged &= sp->purged;
+            sp = nb;
+        }
+    }
+    if (sp->first + sp->npages < rg->npages) {
+        nb = &rg->spans[sp->first + sp->npages];
+        if (nb->state == SPAN_FREE) {
+            spanRemove(nb);
+            sp->npages += nb->npages;
+            sp->purged &= nb->purged;
+        }
+    }
+
+    if (sp->first == rg->hdrpages && sp->first + sp->npages == rg->npages) {
+        for (rp = &regions; *rp != rg; rp = &(*rp)->next)
+            ;
+        *rp = rg->next;
+        mm_free(rg->base);
+        return;
+    }
+    spanMark(sp);
+    spanInsert(sp);
+}
+
+/*
+ * Returns the span that starts at "bp" and is in use, or NULL if "bp" is
+ * not the start of an allocated span.
+ */
+static struct span *spanOf(void *bp)
+{
+    struct span *sp = pagemapSpan(bp);
+
+    if (sp == NULL || sp->state != SPAN_LARGE ||
+        (char *)bp != sp->region->base + (size_t)sp->first * mem_pagesize())
+        return NULL;
+    return sp;
+}
+
+/*
+ * Returns the span that owns the page holding "p", or NULL if none does.
+ */
+static struct span *pagemapSpan(void *p)
+{
+    void *owner = pagemapGet(p);
+
+    return ((uintptr_t)owner & (PM_LMAP | PM_BUDDY)) ? NULL : owner;
+}
+
+/*
+ * Returns the live mapping whose payload is "bp", or NULL.
+ */
+static struct lmap *lmapOf(void *bp)
+{
+    uintptr_t owner = (uintptr_t)pagemapGet(bp);
+    struct lmap *m = (struct lmap *)(owner & ~(uintptr_t)PM_LMAP);
+
+    if (!(owner & PM_LMAP) || (char *)bp != (char *)m + LMAP_HDR ||
+        m->retained)
+        return NULL;
+    return m;
+}
+
+/*
+ * Returns the retained mapping recorded at the page holding "p", which is
+ * its first or last page, or NULL.
+ */
+static struct lmap *lmapAt(void *p)
+{
+    uintptr_t owner = (uintptr_t)pagemapGet(p);
+    struct lmap *m = (struct lmap *)(owner & ~(uintptr_t)PM_LMAP);
+
+    return (owner & PM_LMAP) && m->retained ? m : NULL;
+}
+
+/*
+ * Returns the payload of a mapping for "size" bytes: if "cached", the
+ * smallest retained mapping in the request's size class that fits, else
+ * the first of the next class that has one, less a remainder of
+ * LMAP_SPLIT bytes or more that stays retained; or else a new mapping.
+ * Returns NULL if no mapping can be made.
+ */
+static void *lmapAlloc(size_t size, bool cached)
+{
+    size_t page = mem_pagesize();
+    size_t len = (size + LMAP_HDR + page - 1) & ~(page - 1);
+    size_t c = SIZE_CLASS(len);
+    struct lmap *m, *best = NULL, *rest;
+
+    for (m = cached ? lmap_bins[c] : NULL; m != NULL; m = m->next)
+        if (m->len >= len && (best == NULL || m->len < best->len))
+            best = m;
+    while (cached && best == NULL && ++c < CLASSES)
+        best = lmap_bins[c];
+
+    if ((m = best) != NULL) {
+        lmap_hits++;
+        lmapForget(m);
+        if (m->len - len >= LMAP_SPLIT) {
+            /* The remainder counts as released now. */
+            rest = (struct lmap *)((char *)m + len);
+            rest->len = m->len - len;
+            m->len = len;
+            if (lmapRetain(rest) != 0)
+                munmap(rest, rest->len);
+        }
+        m->retained = false;
+    }
+    else {
+        lmap_misses += cached;
+        if ((m = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+            return NULL;
+        m->len = len;
+        m->retained = false;
+    }
+
+    m->prev = NULL;
+    m->next = lmap_live;
+    if (lmap_live != NULL)
+        lmap_live->prev = m;
+    lmap_live = m;
+    if (pagemapSet(m, 1, (char *)m + PM_LMAP) != 0) {
+        lmapFree(m);
+        return NULL;
+    }
+    return (char *)m + LMAP_HDR;
+}
+
+/*
+ * Retains live mapping "m" for reuse, merged with retained neighbours
+ * that are adjacent in memory, then unmaps the oldest retained mappings
+ * while more than LMAP_MAX or lmap_retain bytes are retained.
+ */
+static void lmapFree(struct lmap *m)
+{
+    struct lmap *next, *prev;
+
+    pagemapSet(m, 1, NULL);
+    if (m->prev != NULL)
+        m->prev->next = m->next;
+    else
+        lmap_live = m->next;
+    if (m->next != NULL)
+        m->next->prev = m->prev;
+
+    if ((next = lmapAt((char *)m + m->len)) != NULL &&
+        (char *)next == (char *)m + m->len) {
+        lmapForget(next);
+        m->len += next->len;
+    }
+    if ((prev = lmapAt((char *)m - 1)) != NULL &&
+        (char *)prev + prev->len == (char *)m) {
+        lmapForget(prev);
+        prev->len += m->len;
+        m = prev;
+    }
+    if (lmapRetain(m) != 0) {
+        munmap(m, m->len);
+        return;
+    }
+
+    while (lmap_count > LMAP_MAX || lmap_bytes > lmap_retain)
+        lmapUnmap(lmap_oldest);
+}
+
+/*
+ * Makes "m" retained as of now: records it at its first and last pages
+ * and puts it in its bin and at the new end of the age list.  Returns 0,
+ * or -1 if the pagemap could not record it.
+ */
+static int lmapRetain(struct lmap *m)
+{
+    struct lmap **bin = &lmap_bins[SIZE_CLASS(m->len)];
+    void *owner = (char *)m + PM_LMAP;
+
+    if (pagemapSet(m, 1, owner) != 0 ||
+        pagemapSet((char *)m + m->len - 1, 1, owner) != 0) {
+        pagemapSet(m, 1, NULL);
+        return -1;
+    }
+    m->retained = true;
+    m->released = lmapClock();
+    m->prev = NULL;
+    m->next = *bin;
+    if (*bin != NULL)
+        (*bin)->prev = m;
+    *bin = m;
+    m->older = lmap_newest;
+    m->newer = NULL;
+    if (lmap_newest != NULL)
+        lmap_newest->newer = m;
+    else
+        lmap_oldest = m;
+    lmap_newest = m;
+    lmap_bytes += m->len;
+    lmap_count++;
+    return 0;
+}
+
+/*
+ * Takes retained mapping "m" out of the pagemap, its bin and the age
+ * list.  It stays marked retained until its caller decides otherwise.
+ */
+static void lmapForget(struct lmap *m)
+{
+    pagemapSet(m, 1, NULL);
+    pagemapSet((char *)m + m->len - 1, 1, NULL);
+    if (m->prev != NULL)
+        m->prev->next = m->next;
+    else
+        lmap_bins[SIZE_CLASS(m->len)] = m->next;
+    if (m->next != NULL)
+        m->next->prev = m->prev;
+    if (m->older != NULL)
+        m->older->newer = m->newer;
+    else
+        lmap_oldest = m->newer;
+    if (m->newer != NULL)
+        m->newer->older = m->older;
+    else
+        lmap_newest = m->older;
+    lmap_bytes -= m->len;
+    lmap_count--;
+}
+
+/*
+ * Unmaps mapping "m", live or retained, and forgets it.
+ */
+static void lmapUnmap(struct lmap *m)
+{
+    if (m->retained)
+        lmapForget(m);
+    else {
+        pagemapSet(m, 1, NULL);
+        if (m->prev != NULL)
+            m->prev->next = m->next;
+        else
+            lmap_live = m->next;
+        if (m->next != NULL)
+            m->next->prev = m->prev;
+    }
+    munmap(m, m->len);
+}
+
+/* Returns a monotonic clock in milliseconds. */
+static uint64_t lmapClock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Returns the owner recorded for the page holding "p", or NULL.  Safe to
+ * call while another thread updates the pagemap.
+ */
+static void *pagemapGet(void *p)
+{
+    uintptr_t pn = (uintptr_t)p >> PM_SHIFT;
+    struct pmnode *node;
+    struct pmleaf *leaf;
+
+    node = __atomic_load_n(&pagemap[(pn >> (2 * PM_BITS)) & (PM_SIZE - 1)],
+        __ATOMIC_ACQUIRE);
+    if (node == NULL)
+        return NULL;
+    leaf = __atomic_load_n(&node->leaf[(pn >> PM_BITS) & (PM_SIZE - 1)],
+        __ATOMIC_ACQUIRE);
+    if (leaf == NULL)
+        return NULL;
+    return __atomic_load_n(&leaf->owner[pn & (PM_SIZE - 1)],
+        __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Maps a zeroed pagemap node of "size" bytes and installs it in "slot"
+ * unless another thread got there first.  Returns the installed node, or
+ * NULL if the mapping failed.
+ */
+static void *pagemapNode(void **slot, size_t size)
+{
+    void *node = __atomic_load_n(slot, __ATOMIC_ACQUIRE), *expected = NULL;
+
+    if (node != NULL)
+        return node;
+    node = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (node == MAP_FAILED)
+        return NULL;
+    if (!__atomic_compare_exchange_n(slot, &expected, node, false,
+        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        munmap(node, size);
+        return expected;
+    }
+    return node;
+}
+
+/*
+ * Records "owner" for every page of [p, p + len).  Returns 0, or -1 if a
+ * pagemap node could not be mapped (only possible for a non-NULL owner).
+ */
+static int pagemapSet(void *p, size_t len, void *owner)
+{
+    uintptr_t pn, end = ((uintptr_t)p + len - 1) >> PM_SHIFT;
+    struct pmnode *node;
+    struct pmleaf *leaf;
+
+    for (pn = (uintptr_t)p >> PM_SHIFT; pn <= end; pn++) {
+        node = pagemapNode((void **)&pagemap[(pn >> (2 * PM_BITS)) &
+            (PM_SIZE - 1)], sizeof(*node));
+        if (node == NULL)
+            return -1;
+        leaf = pagemapNode((void **)&node->leaf[(pn >> PM_BITS) &
+            (PM_SIZE - 1)], sizeof(*leaf));
+        if (leaf == NULL)
+            return -1;
+        __atomic_store_n(&leaf->owner[pn & (PM_SIZE - 1)], owner,
+            __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/*
+ * Makes the descriptor of the last page of "sp" point back at its first.
+ */
+static void spanMark(struct span *sp)
+{
+    sp->region->spans[sp->first + sp->npages - 1].first = sp->first;
+}
+
+/* Inserts free span "sp" at the head of its bin. */
+static void spanInsert(struct span *sp)
+{
+    struct span **bin = &span_bins[MIN(sp->npages, (uint32_t)SPAN_BINS - 1)];
+
+    sp->prev = NULL;
+    sp->next = *bin;
+    if (*bin != NULL)
+        (*bin)->prev = sp;
+    *bin = sp;
+}
+
+/* Removes free span "sp" from its bin. */
+static void spanRemove(struct span *sp)
+{
+    if (sp->prev != NULL)
+        sp->prev->next = sp->next;
+    else
+        span_bins[MIN(sp->npages, (uint32_t)SPAN_BINS - 1)] = sp->next;
+    if (sp->next != NULL)
+        sp->next->prev = sp->prev;
+}
+
+/*
+ * Returns whether "bp" lies in the mesh heap.
+ */
+static bool inMesh(void *bp)
+{
+    return mesh_base != NULL && (char *)bp >= mesh_base &&
+        (char *)bp < mesh_base + (size_t)MESH_PAGES * mem_pagesize();
+}
+
+/*
+ * Allocates a slot of the smallest class that holds "size" bytes, from a
+ * partly used page of the class or else from a fresh virtual page whose
+ * physical page is its own page of the memfd.  Creates the mesh heap on
+ * first use.  Returns NULL if the heap cannot be created or is full.
+ */
+static void *meshAlloc(size_t size)
+{
+    size_t page = mem_pagesize(), off;
+    struct mpage *mp;
+    uint32_t v, i;
+    int c, w, slot;
+
+    if (mesh_base == NULL) {
+        if ((mesh_fd = memfd_create("mm-mesh", MFD_CLOEXEC)) < 0)
+            return NULL;
+        if (ftruncate(mesh_fd, (off_t)MESH_PAGES * page) < 0 ||
+            (mesh_base = mmap(NULL, (size_t)MESH_PAGES * page,
+            PROT_READ | PROT_WRITE, MAP_SHARED, mesh_fd, 0)) == MAP_FAILED) {
+            close(mesh_fd);
+            mesh_base = NULL;
+            return NULL;
+        }
+        if ((mesh_grains = mmap(NULL, MESH_PAGES * MESH_GWORDS *
+            sizeof(uint64_t), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+            munmap(mesh_base, (size_t)MESH_PAGES * page);
+            close(mesh_fd);
+            mesh_base = NULL;
+            return NULL;
+        }
+        if (!mesh_atfork) {
+            pthread_atfork(meshForkPrepare, meshForkParent, meshForkChild);
+            mesh_atfork = true;
+        }
+        for (v = 0; v < MESH_PAGES; v++)
+            mesh_map[v] = MESH_NONE;
+        memset(mesh_partial, 0, sizeof(mesh_partial));
+        memset(mesh_color, 0, sizeof(mesh_color));
+        mesh_cursor = 0;
+    }
+
+    for (c = 0; mesh_sizes[c] < size; c++)
+        ;
+    if ((mp = mesh_partial[c]) == NULL) {
+        /* Take the next unused virtual page, mapped at its own offset. */
+        for (i = 0; i < MESH_PAGES; i++) {
+            v = (mesh_cursor + i) % MESH_PAGES;
+            if (mesh_map[v] == MESH_NONE)
+                break;
+        }
+        if (i == MESH_PAGES)
+            return NULL;
+        mesh_cursor = v + 1;
+        mesh_map[v] = v;
+        mp = &mesh_phys[v];
+        memset(mp, 0, sizeof(*mp));
+        memset(MESH_GRAINS(v), 0, MESH_GWORDS * sizeof(uint64_t));
+        mp->sclass = c;
+        mp->color = meshColor(c);
+        mp->nfree = MESH_SLOTS(c);
+        mp->nalias = 1;
+        mp->alias[0] = v;
+        meshLink(mp);
+    }
+
+    for (w = 0; ~mp->used[w] == 0; w++)
+        ;
+    slot = w * 64 + __builtin_ctzl(~mp->used[w]);
+    mp->used[w] |= (uint64_t)1 << (slot % 64);
+    off = mp->color + (size_t)slot * mesh_sizes[c];
+    oobFill(MESH_GRAINS(mp - mesh_phys), off / MESH_GRAIN,
+        mesh_sizes[c] / MESH_GRAIN, true);
+    mp->nlive++;
+    if (--mp->nfree == 0)
+        meshUnlink(mp);
+    return mesh_base + (size_t)mp->alias[0] * page + off;
+}
 
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* free block header */
-    PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+/*
+ * Frees mesh-heap block "bp".  Its bytes leave the page's occupancy map,
+ * and each own slot of the page it overlapped becomes available once no
+ * other object overlaps it.  A page left empty is released.
+ */
+static void meshFree(void *bp)
+{
+    size_t page = mem_pagesize();
+    size_t off = (char *)bp - mesh_base;
+    uint32_t p = mesh_map[off / page];
+    struct mpage *mp = &mesh_phys[p];
+    size_t size = mesh_sizes[mp->sclass], n = MESH_SLOTS(mp->sclass);
+    size_t k, g;
 
-    /* Coalesce if the previous block was free */
-    return coalesce(bp);
+    off %= page;
+    oobFill(MESH_GRAINS(p), off / MESH_GRAIN, size / MESH_GRAIN, false);
+    k = off + size <= mp->color ? n :
+        off <= mp->color ? 0 : (off - mp->color) / size;
+    for (; k < n && mp->color + k * size < off + size; k++) {
+        g = (mp->color + k * size) / MESH_GRAIN;
+        if (!(mp->used[k / 64] >> (k % 64) & 1) ||
+            oobNext(MESH_GRAINS(p), g, g + size / MESH_GRAIN, true) <
+            g + size / MESH_GRAIN)
+            continue;
+        mp->used[k / 64] &= ~((uint64_t)1 << (k % 64));
+        if (mp->nfree++ == 0)
+            meshLink(mp);
+    }
+    if (--mp->nlive == 0) {
+        meshUnlink(mp);
+        meshRelease(mp);
+    }
 }
 
+/*
+ * Releases empty physical page "mp": its memory goes back to the system,
+ * and each virtual page that mapped it is mapped at its own offset again
+ * and becomes unused.
+ */
+static void meshRelease(struct mpage *mp)
+{
+    size_t page = mem_pagesize();
+    uint32_t p = mp - mesh_phys, v;
+    int i;
+
+    fallocate(mesh_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+        (off_t)p * page, page);
+    for (i = 0; i < mp->nalias; i++) {
+        v = mp->alias[i];
+        if (v != p)
+            mmap(mesh_base + (size_t)v * page, page, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, mesh_fd, (off_t)v * page);
+        mesh_map[v] = MESH_NONE;
+    }
+}
 
 /*
- * Requires:
- *   "bp" is the address of a newly freed block.
- *
- * Effects:
- *   Perform boundary tag coalescing.  Returns the address of the coalesced
- *   block.
+ * Folds physical page "src" into "dst": the live bytes of "src" are
+ * copied to the same offsets of "dst", every virtual page of "src" is
+ * remapped onto "dst", and the memory of "src" is released.  The pages'
+ * occupancy maps must not overlap; their colours may differ.
  */
-static void *coalesce(void *bp)
+static void meshFold(struct mpage *dst, struct mpage *src)
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp))) || PREV_BLKP(bp) == bp;
-    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-    size_t size = GET_SIZE(HDRP(bp));
+    size_t page = mem_pagesize(), size = mesh_sizes[src->sclass];
+    size_t grains = page / MESH_GRAIN, g, e, k;
+    char *from = mesh_base + (size_t)src->alias[0] * page;
+    char *to = mesh_base + (size_t)dst->alias[0] * page;
+    uint32_t p = dst - mesh_phys, v;
+    uint64_t *dmap = MESH_GRAINS(p), *smap = MESH_GRAINS(src - mesh_phys);
+    int i;
 
-    /* Case 1, left coalesce */
-     if (prev_alloc && !next_alloc)
-    {           
-        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        delete(NEXT_BLKP(bp));
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
+    for (g = 0; (g = oobNext(smap, g, grains, true)) < grains; g = e) {
+        e = oobNext(smap, g, grains, false);
+        memcpy(to + g * MESH_GRAIN, from + g * MESH_GRAIN,
+            (e - g) * MESH_GRAIN);
     }
 
-    /* Case 2, right coalesce */
-    else if (!prev_alloc && next_alloc)
-    {       
-        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        bp = PREV_BLKP(bp);
-        delete(bp);
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
+    for (i = 0; i < src->nalias; i++) {
+        v = src->alias[i];
+        mmap(mesh_base + (size_t)v * page, page, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED, mesh_fd, (off_t)p * page);
+        mesh_map[v] = p;
+        dst->alias[dst->nalias++] = v;
     }
+    fallocate(mesh_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+        (off_t)(src - mesh_phys) * page, page);
 
-    /* Case 3, extend the block in both directions */
-    else if (!prev_alloc && !next_alloc)
-    {       
-        size += GET_SIZE(HDRP(PREV_BLKP(bp))) +
-                GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        delete(PREV_BLKP(bp));
-        delete(NEXT_BLKP(bp));
-        bp = PREV_BLKP(bp);
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
+    /* Own slots of "dst" that the objects of "src" overlap are taken. */
+    for (g = 0; g < MESH_GWORDS; g++)
+        dmap[g] |= smap[g];
+    for (k = 0; k < MESH_SLOTS(dst->sclass); k++) {
+        g = (dst->color + k * size) / MESH_GRAIN;
+        if (!(dst->used[k / 64] >> (k % 64) & 1) &&
+            oobNext(dmap, g, g + size / MESH_GRAIN, true) <
+            g + size / MESH_GRAIN) {
+            dst->used[k / 64] |= (uint64_t)1 << (k % 64);
+            dst->nfree--;
+        }
     }
-   
-    add(bp);   
-    return bp;
+    dst->nlive += src->nlive;
+    meshUnlink(src);
+    if (dst->nfree == 0)
+        meshUnlink(dst);
 }
 
 /*
- * Requires:
- *   None.
- *
- * Effects:
- *   Find a fit in the explicit free list for a block with "asize" bytes.  Returns that block's address
- *   or NULL if no suitable block was found.
+ * Fork handlers.  The mesh heap is a shared mapping of the memfd, so a
+ * child would otherwise write into its parent's objects.  The heap lock
+ * is held across fork so that no fold or release is half done, and the
+ * child copies every live physical page into a memfd of its own, maps
+ * its virtual pages onto that and starts with a fresh lock.
  */
-static void *findFit(size_t asize)
+static void meshForkPrepare(void)
 {
-    void *bp;
-    /* First fit search */   
-    for (bp = free_listp; GET_ALLOC(HDRP(bp)) == 0; bp = NEXT_FREEP(bp))
-    {
-        if (asize <= (size_t)GET_SIZE(HDRP(bp)))
-            return bp;
+    HEAP_LOCK();
+}
+
+static void meshForkParent(void)
+{
+    HEAP_UNLOCK();
+}
+
+static void meshForkChild(void)
+{
+    size_t page = mem_pagesize();
+    uint32_t v, p;
+    bool ok;
+    int fd;
+
+    if (mesh_base != NULL &&
+        (fd = memfd_create("mm-mesh", MFD_CLOEXEC)) >= 0) {
+        ok = ftruncate(fd, (off_t)MESH_PAGES * page) == 0;
+        for (v = 0; ok && v < MESH_PAGES; v++)
+            if ((p = mesh_map[v]) != MESH_NONE && mesh_phys[p].alias[0] == v)
+                ok = pwrite(fd, mesh_base + (size_t)v * page, page,
+                    (off_t)p * page) == (ssize_t)page;
+        if (ok) {
+            mmap(mesh_base, (size_t)MESH_PAGES * page,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+            for (v = 0; v < MESH_PAGES; v++)
+                if ((p = mesh_map[v]) != MESH_NONE && p != v)
+                    mmap(mesh_base + (size_t)v * page, page,
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+                        (off_t)p * page);
+            close(mesh_fd);
+            mesh_fd = fd;
+        } else
+            close(fd);
     }
-    return NULL; // No fit
+
+    /* The thread has a new id here, so its hold cannot be released. */
+    heap_lock = (pthread_mutex_t)PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+}
+
+/* Adds "mp" to the partly used pages of its class. */
+static void meshLink(struct mpage *mp)
+{
+    mp->prev = NULL;
+    mp->next = mesh_partial[mp->sclass];
+    if (mp->next != NULL)
+        mp->next->prev = mp;
+    mesh_partial[mp->sclass] = mp;
 }
 
 /*
- * Requires:
- *   "bp" is the address of a free block that is at least "asize" bytes.
- *
- * Effects:
- *   Place a block of "asize" bytes at the start of the free block "bp" and
- *   split that block if the remainder would be at least the minimum block
- *   size.
+ * Returns the colour of a new page of class "c".  Colours step by a cache
+ * line, since a smaller step leaves the first slot in the same cache set,
+ * and wrap around once they would push the last slot off the page.  A
+ * class whose slack is shorter than a line is not coloured.
  */
-static void place(void *bp, size_t asize)
+static uint16_t meshColor(int c)
 {
-    size_t csize = GET_SIZE(HDRP(bp));
+    size_t slack = mem_pagesize() - MESH_SLOTS(c) * mesh_sizes[c];
+    uint16_t color = mesh_color[c];
 
-    /* If the difference is at least MINIMUM bytes, change the header and footer
-     * info for the allocated block (size = asize, allocated = 1) and
-     * remove the block from the free list.
-     * Then, split the block by:
-     * (1) Changing the header and footer info for the free block created from the
-     * remaining space (size = csize-asize, allocated = 0)
-     * (2) Coalescing the new free block with adjacent free blocks
-    */
-    if ((csize - asize) >= MINIMUM) {
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+    mesh_color[c] = (size_t)color + CACHELINE > slack ? 0 : color + CACHELINE;
+    return color;
+}
 
-	/* Deleting block from free list */
-        delete(bp);
-        bp = NEXT_BLKP(bp);
+/* Returns whether any byte is live on both "a" and "b". */
+static bool meshOverlap(struct mpage *a, struct mpage *b)
+{
+    uint64_t *am = MESH_GRAINS(a - mesh_phys);
+    uint64_t *bm = MESH_GRAINS(b - mesh_phys);
+    size_t w;
 
-	/*Splitting the block */
-        PUT(HDRP(bp), PACK(csize-asize, 0));
-        PUT(FTRP(bp), PACK(csize-asize, 0));
+    for (w = 0; w < MESH_GWORDS; w++)
+        if (am[w] & bm[w])
+            return true;
+    return false;
+}
 
-	/*Coalescing the newly freed block */
-        coalesce(bp);
-    }
-    /* If the remaining space is not enough for a free block, don't split the block */
-    else {
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
-        delete(bp);
-    }
+/* Removes "mp" from the partly used pages of its class. */
+static void meshUnlink(struct mpage *mp)
+{
+    if (mp->prev != NULL)
+        mp->prev->next = mp->next;
+    else
+        mesh_partial[mp->sclass] = mp->next;
+    if (mp->next != NULL)
+        mp->next->prev = mp->prev;
 }
 
-/* 
- * Requires:
- *   None.
- *
- * Effects:
- *   Perform a minimal check of the heap for consistency. 
+/* Bit operations on the allocated and start bitmaps of a dense span */
+#define OOB_SET(map, g)   ((map)[(g) / 64] |= (uint64_t)1 << ((g) % 64))
+#define OOB_CLEAR(map, g) ((map)[(g) / 64] &= ~((uint64_t)1 << ((g) % 64)))
+#define OOB_STARTS(om)    ((om)->alloc + ((om)->ngrain + 63) / 64)
+
+/*
+ * Returns the first granule in [g, limit) whose bit in "map" is "set", or
+ * "limit" if there is none.  Scans a word at a time.
  */
-static void checkheap(int verbose)
+static size_t oobNext(const uint64_t *map, size_t g, size_t limit, bool set)
 {
-    	void *bp = heap_listp, *bp1; 
-	int heap = 0, free = 0;
-	void *curr = heap_listp;
-	//printf("HI\n");
+    uint64_t bits;
 
-    if (verbose)
-        printf("Heap (%p):\n", heap_listp);
+    while (g < limit) {
+        bits = set ? map[g / 64] : ~map[g / 64];
+        bits &= ~(uint64_t)0 << (g % 64);
+        if (bits != 0)
+            return MIN(g - g % 64 + __builtin_ctzl(bits), limit);
+        g += 64 - g % 64;
+    }
+    return limit;
+}
 
-    
-    if ((GET_SIZE(HDRP(heap_listp)) != MINIMUM) ||
-            !GET_ALLOC(HDRP(heap_listp)))
-        printf("Bad prologue header\n");
-    checkblock(heap_listp); 
+/* Sets ("on") or clears the bits of granules [g, g+n) in "map". */
+static void oobFill(uint64_t *map, size_t g, size_t n, bool on)
+{
+    uint64_t mask;
+    size_t k;
 
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-		if (verbose){
-			printblock(bp);}
-		checkblock(bp);
-	}
+    for (; n > 0; g += k, n -= k) {
+        k = MIN(n, 64 - g % 64);
+        mask = (k == 64 ? ~(uint64_t)0 : ((uint64_t)1 << k) - 1) << (g % 64);
+        if (on)
+            map[g / 64] |= mask;
+        else
+            map[g / 64] &= ~mask;
+    }
+}
 
-	if (verbose)
-		printblock(bp);
-	if (GET_SIZE(HDRP(bp)) != 0 || !GET_ALLOC(HDRP(bp)))
-		printf("Bad epilogue header\n");
+/* Adds "om" to the spans with free granules. */
+static void oobLink(struct oobmeta *om)
+{
+    om->prev = NULL;
+    om->next = oob_spans;
+    if (oob_spans != NULL)
+        oob_spans->prev = om;
+    oob_spans = om;
+}
 
+/* Removes "om" from the spans with free granules. */
+static void oobUnlink(struct oobmeta *om)
+{
+    if (om->prev != NULL)
+        om->prev->next = om->next;
+    else
+        oob_spans = om->next;
+    if (om->next != NULL)
+        om->next->prev = om->prev;
+}
 
+/*
+ * Allocates "size" bytes from the first dense span with a long enough run
+ * of free granules, creating a span if none has one.  A span left with no
+ * free granules is unlinked until a block in it is freed.  Returns NULL if
+ * no span can be created.
+ */
+static void *oobAlloc(size_t size)
+{
+    size_t n = (size + OOB_GRAIN - 1) / OOB_GRAIN, g, e, words;
+    struct oobmeta *om;
+    struct span *sp;
 
-    /* Print the stats of every free block in the free list */
-    for (bp = free_listp; GET_ALLOC(HDRP(bp))==0; bp = NEXT_FREEP(bp))
-    {
-        if (verbose)
-            printblock(bp);
-        checkblock(bp);
+    for (om = oob_spans; om != NULL; om = om->next) {
+        if (om->nfree < n)
+            continue;
+        for (g = 0; (g = oobNext(om->alloc, g, om->ngrain, false)) + n <=
+             om->ngrain; g = e) {
+            e = oobNext(om->alloc, g, g + n, true);
+            if (e == g + n)
+                goto found;
+        }
     }
 
-	/*Checks if every block in free list is marked free */
-	for (bp = free_listp; bp != NULL; bp = NEXT_FREEP(bp))
-    {
-        if (GET_ALLOC(HDRP(bp))==1)
-            printf("Allocation Status of free block is wrong\n");
+    /* No room: start a new span, metadata apart from the payloads. */
+    if ((sp = spanAlloc(OOB_PAGES, SPAN_OOB)) == NULL)
+        return NULL;
+    g = (size_t)OOB_PAGES * mem_pagesize() / OOB_GRAIN;
+    words = (g + 63) / 64;
+    om = allocate(sizeof(*om) + 2 * words * sizeof(uint64_t),
+        FLAG_HEAP | MM_LONGLIVED | MM_NOCACHE, 0);
+    if (om == NULL) {
+        spanFree(sp);
+        return NULL;
     }
+    memset(om->alloc, 0, 2 * words * sizeof(uint64_t));
+    om->base = sp->region->base + (size_t)sp->first * mem_pagesize();
+    om->span = sp;
+    om->ngrain = om->nfree = g;
+    oobLink(om);
+    sp->meta = om;
+    g = 0;
 
-	/*Checks if all free blocks are in free list*/
-	
+found:
+    OOB_SET(OOB_STARTS(om), g);
+    oobFill(om->alloc, g, n, true);
+    if ((om->nfree -= n) == 0)
+        oobUnlink(om);
+    return om->base + g * OOB_GRAIN;
+}
 
-	for (bp = free_listp; GET_ALLOC(HDRP(bp))==0; bp = NEXT_FREEP(bp))
-    {
-        if (verbose)
-            printblock(bp);
-        checkblock(bp);
+/*
+ * Returns the payload size of dense-span block "bp": its granules run up
+ * to the first free granule or the next block's start.
+ */
+static size_t oobSize(struct oobmeta *om, void *bp)
+{
+    size_t g = ((char *)bp - om->base) / OOB_GRAIN, k;
+
+    k = oobNext(om->alloc, g + 1, om->ngrain, false);
+    k = oobNext(OOB_STARTS(om), g + 1, k, true);
+    return (k - g) * OOB_GRAIN;
+}
+
+/*
+ * Frees dense-span block "bp" by clearing its bits; free granules merge
+ * with their neighbours implicitly.  A full span is linked again, and an
+ * empty span goes back to the page heap together with its metadata.
+ */
+static void oobFree(struct oobmeta *om, void *bp)
+{
+    size_t g = ((char *)bp - om->base) / OOB_GRAIN;
+    size_t n = oobSize(om, bp) / OOB_GRAIN;
+
+    OOB_CLEAR(OOB_STARTS(om), g);
+    oobFill(om->alloc, g, n, false);
+    if (om->nfree == 0)
+        oobLink(om);
+    if ((om->nfree += n) < om->ngrain)
+        return;
+
+    oobUnlink(om);
+    spanFree(om->span);
+    mm_free(om);
+}
+
+/*
+ * Returns the entry of "v" (sorted by address, "n" long) whose payload
+ * contains address "w", or NULL if there is none.
+ */
+static struct leakent *leakFind(struct leakent *v, size_t n, uintptr_t w)
+{
+    size_t lo = 0, hi = n, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (w < (uintptr_t)v[mid].bp)
+            hi = mid;
+        else if (w >= (uintptr_t)v[mid].bp + v[mid].size - DSIZE)
+            lo = mid + 1;
+        else
+            return &v[mid];
     }
+    return NULL;
+}
 
-		
-	/* CHecks for overlapping allocated blocks*/
-	
-	for (bp = heap_listp; NEXT_BLKP(bp) != NULL; bp = NEXT_BLKP(bp))
-    {
-	if(GET_ALLOC(HDRP(bp)) == 1 && GET_ALLOC(HDRP(curr)) == 1){     
-		if(HDRP(curr) < (void *)(FTRP(bp) + WSIZE))			//If both allocated and not overlapping
-			curr = bp;
-		else 
-			printf("Allocated blocks are overlapping\n");  //If both allocated and overlapping
-	}	        
+/*
+ * Marks the blocks that the roots point into: the registers and stack of
+ * the calling thread, and the data and bss segments less the allocator's
+ * words that point at blocks without holding them: the realloc table and
+ * the base of the mesh heap.  Apart from mm_leak_check so that none of
+ * its locals lives across setjmp.
+ */
+static void leakRoots(struct leakwalk *lw)
+{
+    char *skip[2][2] = {
+        { (char *)growers, (char *)(growers + GROWERS) },
+        { (char *)&mesh_base, (char *)(&mesh_base + 1) }
+    };
+    char *hi = __libc_stack_end, **s;
+    pthread_attr_t attr;
+    jmp_buf regs;
+    void *lo;
+    size_t len;
+    int k;
+
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        if (pthread_attr_getstack(&attr, &lo, &len) == 0)
+            hi = (char *)lo + len;
+        pthread_attr_destroy(&attr);
     }
+    setjmp(regs);
+    leakScan(lw, (char *)&regs, hi, NULL, NULL);
 
-	/* Checks if free block pointers point to valid free blocks */
-	for (bp = free_listp; bp != NULL; bp = NEXT_FREEP(bp))
-    {
-        if((void *)bp < HDRP(bp) && (void *)bp > FTRP(bp))
-		printf("Pointer points to invalid block\n");
+    /* Scan the segments around the skipped words, lowest first. */
+    for (lo = __data_start; ; lo = s[1]) {
+        for (s = NULL, k = 0; k < 2; k++)
+            if (skip[k][0] >= (char *)lo && (s == NULL || skip[k][0] < s[0]))
+                s = skip[k];
+        if (s == NULL)
+            break;
+        leakScan(lw, lo, s[0], NULL, NULL);
     }
+    leakScan(lw, lo, _end, NULL, NULL);
+}
 
-		
+/*
+ * Treats every aligned word in [lo, hi) as a possible pointer and marks the
+ * blocks it points into.  A pointer into the mesh heap is taken through
+ * the first virtual page of its physical page, where leakMesh lists the
+ * objects.  A newly marked block is claimed for scanning and
+ * pushed onto "stack" while it has room; otherwise, or without a stack, it
+ * is left for a later walk.
+ */
+static void leakScan(struct leakwalk *lw, char *lo, char *hi, size_t *stack,
+    size_t *top)
+{
+    uintptr_t page = mem_pagesize(), *w, p, v;
+    unsigned char none = 0;
+    struct leakent *e;
 
-	/* CHecks if adjacent free blocks have not been coalesced */
-	for (bp = free_listp; bp != NULL; bp = NEXT_FREEP(bp) ) free++;
-	for (bp1 = heap_listp; bp1 != NULL; bp1 = NEXT_BLKP(bp1) ){
-    
-        if (GET_ALLOC(HDRP(bp1)) == 0)
-		 heap++;            
+    lo = (char *)(((uintptr_t)lo + WSIZE - 1) & ~(uintptr_t)(WSIZE - 1));
+    for (w = (uintptr_t *)lo; (char *)(w + 1) <= hi; w++) {
+        p = *w;
+        if (inMesh((void *)p) && (v = (p - (uintptr_t)mesh_base) / page,
+            mesh_map[v] != MESH_NONE))
+            p = (uintptr_t)mesh_base + (uintptr_t)mesh_phys[mesh_map[v]]
+                .alias[0] * page + p % page;
+        if ((e = leakFind(lw->v, lw->n, p)) == NULL ||
+            __atomic_load_n(&e->mark, __ATOMIC_RELAXED) != 0 ||
+            !__atomic_compare_exchange_n(&e->mark, &none, LEAK_MARKED,
+            false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            none = 0;
+            continue;
+        }
+        if (stack != NULL && *top < LEAK_STACK) {
+            __atomic_store_n(&e->mark, LEAK_SCANNED, __ATOMIC_RELAXED);
+            stack[(*top)++] = e - lw->v;
+        }
+        else
+            __atomic_store_n(&lw->again, 1, __ATOMIC_RELAXED);
     }
-	if(heap != free) 
-		printf("Not all free blocks are in the free list\n");
-
-	
-   
 }
 
 /*
- * printblock - Prints the details of a block in the list.
- * This function displays previous and next pointers if the block
- * is marked as free.
- *
- * This function takes a block pointer (to a block for examination) as a
- * parameter.
+ * Scans marked block "e", unless another walker claimed it first, and
+ * every block reached from it that fits on this walker's stack.
  */
-static void printblock(void *bp)
+static void leakDrain(struct leakwalk *lw, struct leakent *e)
 {
-    int hsize, halloc, fsize, falloc;
-	size_t h,f;
-    /* Basic header and footer information */
-    checkheap(false);
-    hsize = GET_SIZE(HDRP(bp));
-    halloc = GET_ALLOC(HDRP(bp));
-    fsize = GET_SIZE(FTRP(bp));
-    falloc = GET_ALLOC(FTRP(bp));
+    unsigned char marked = LEAK_MARKED;
+    size_t stack[LEAK_STACK], top = 0, i;
 
-    if (hsize == 0)
-    {
-        printf("%p: end of heap\n", bp);
+    if (!__atomic_compare_exchange_n(&e->mark, &marked, LEAK_SCANNED, false,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
         return;
+    stack[top++] = e - lw->v;
+    while (top > 0) {
+        i = stack[--top];
+        leakScan(lw, lw->v[i].bp, lw->v[i].bp + lw->v[i].size - DSIZE,
+            stack, &top);
     }
-   
-    /* Prints out header and footer info if it's an allocated block.
-     * Prints out header and footer info and next and prev info
-     * if it's a free block.
-    */
-	h=hsize;
-	f=fsize;
-	printf("%p: header:[%zu:%c] footer:[%zu:%c]\n",bp,h,(halloc ? 'a' : 'f'),f,(falloc ? 'a' : 'f'));
 }
 
-static void checkblock(void *bp)
+/*
+ * Walker of mm_leak_check: drains the marked candidates inside heap block
+ * "blk", which is the block itself or the blocks of a buddy zone.
+ */
+static int leakWalk(const struct mm_block_info *blk, void *ctx)
 {
-    /* CHecks if the pointers in heap point to valid addresses */
-    if (NEXT_FREEP(bp)< mem_heap_lo() || NEXT_FREEP(bp) > mem_heap_hi())
-        printf("Error: next pointer %p is not within heap bounds, points to invalid address \n"
-                , NEXT_FREEP(bp));
-    if (PREV_FREEP(bp)< mem_heap_lo() || PREV_FREEP(bp) > mem_heap_hi())
-        printf("Error: prev pointer %p is not within heap bounds, points to invalid address \n"
-                , PREV_FREEP(bp));
-
-    /* Reports if there isn't DSIZE alignment by checking if the block pointer
-     * is divisible by DSIZE.
-    */
-    if ((size_t)bp % 8)
-        printf("Error: %p is not doubleword aligned\n", bp);
+    struct leakwalk *lw = ctx;
+    char *end = (char *)blk->addr + blk->size;
+    size_t lo = 0, hi = lw->n, mid;
 
-    /* Reports if the header does not match the footer for a free block*/
-    if (!GET_ALLOC(bp) && GET(HDRP(bp)) != GET(FTRP(bp)))
-        printf("Error: header does not match footer\n");
+    if (!blk->alloc)
+        return 0;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (lw->v[mid].bp < (char *)blk->addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (; lo < lw->n && lw->v[lo].bp < end; lo++)
+        if (__atomic_load_n(&lw->v[lo].mark, __ATOMIC_RELAXED) == LEAK_MARKED)
+            leakDrain(lw, &lw->v[lo]);
+    return 0;
 }
 
-
 /*
- * Inserts a block at the front of the explicit free list
+ * Lists the live objects of the mesh heap in "v", unless it is NULL, at
+ * the first virtual page of each physical page, and returns their number.
+ * The pages of a physical page all hold one class and objects never
+ * overlap, so each run of live bytes is a row of whole objects, whatever
+ * colour each came from.
  */
-static void add(void *bp)
+static size_t leakMesh(struct leakent *v)
 {
-    NEXT_FREEP(bp) = free_listp;        //Sets next ptr to start of free list
-    PREV_FREEP(free_listp) = bp;        //Sets current's prev to new block
-    PREV_FREEP(bp) = NULL;              // Sets prev pointer to NULL
-    free_listp = bp;                    // Sets start of free list as new block
+    size_t page = mem_pagesize(), grains = page / MESH_GRAIN, n = 0;
+    size_t size, g, e;
+    struct mpage *mp;
+    uint32_t p;
+    char *base;
+
+    for (p = 0; mesh_base != NULL && p < MESH_PAGES; p++) {
+        mp = &mesh_phys[p];
+        if (mp->nalias == 0 || mesh_map[mp->alias[0]] != p)
+            continue;
+        size = mesh_sizes[mp->sclass];
+        base = mesh_base + (size_t)mp->alias[0] * page;
+        for (g = 0; (g = oobNext(MESH_GRAINS(p), g, grains, true)) < grains;
+            g = e) {
+            e = oobNext(MESH_GRAINS(p), g, grains, false);
+            for (; g < e; g += size / MESH_GRAIN, n++)
+                if (v != NULL) {
+                    v[n].bp = base + g * MESH_GRAIN;
+                    v[n].size = size + DSIZE;
+                    v[n].site = 0;
+                    v[n].mark = 0;
+                }
+        }
+    }
+    return n;
 }
 
 /*
- * Removes a block from the free list
- * If there's a prev block, set the next pointer of this block 
- * to the next pointer of the current block.
- * If not, set the next block's previous pointer to the prev 
- * of the current block.
+ * Lists the blocks in mappings of their own, live large mappings and
+ * guarded ones, in "v", unless it is NULL, and returns their number.
  */
+static size_t leakMaps(struct leakent *v)
+{
+    struct gmap *gm;
+    struct lmap *m;
+    size_t n = 0;
 
-static void delete(void *bp)
+    for (m = lmap_live; m != NULL; m = m->next, n++)
+        if (v != NULL) {
+            v[n].bp = (char *)m + LMAP_HDR;
+            v[n].size = m->len - LMAP_HDR + DSIZE;
+            v[n].site = 0;
+            v[n].mark = 0;
+        }
+    for (gm = guard_live; gm != NULL; gm = gm->next, n++)
+        if (v != NULL) {
+            v[n].bp = gm->bp;
+            v[n].size = GET_SIZE(HDRP(gm->bp));
+            v[n].site = 0;
+            v[n].mark = 0;
+        }
+    return n;
+}
+
+/* qsort comparators for the leak report */
+static int leakBySize(const void *a, const void *b)
 {
-    
-    if (PREV_FREEP(bp))
-        NEXT_FREEP(PREV_FREEP(bp)) = NEXT_FREEP(bp);
-    else
-        free_listp = NEXT_FREEP(bp);
-    PREV_FREEP(NEXT_FREEP(bp)) = PREV_FREEP(bp);
+    const struct leakent *x = a, *y = b;
+
+    return x->size < y->size ? -1 : x->size > y->size;
+}
+
+static int leakBySite(const void *a, const void *b)
+{
+    const struct leakent *x = a, *y = b;
+
+    return x->site < y->site ? -1 : x->site > y->site;
+}
+
+static int leakByAddress(const void *a, const void *b)
+{
+    const struct leakent *x = a, *y = b;
+
+    return x->bp < y->bp ? -1 : x->bp > y->bp;
 }
 
 /*
@@ -0,0 +1,227 @@
+/*
+ * Extended interface to the allocator in mm.c.
+ *
+ * Everything declared here is optional.  A client that only includes mm.h
+ * gets the classic malloc/free/realloc behaviour; the routines below switch
+ * on extra placement policies or expose extra entry points.
+ *
+ * Every entry point, in mm.h and here, serializes on one recursive heap
+ * lock, so threads may call them at the same time, and the background
+ * threads of mm_free_async, mm_set_grow_ahead and mm_pressure_monitor may
+ * be started whenever other threads are using the heap.
+ */
+#ifndef MMX_H
+#define MMX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Flags for mm_mallocx.  The low six bits hold log2 of the requested
+ * payload alignment (0 means the default double-word alignment, as does
+ * MM_ALIGN(0)), bits 16-19 select one of 16 arenas (MM_ARENA keeps the low
+ * four bits of its argument), and the remaining bits are placement hints.
+ * Alignments above 1 << MM_LG_ALIGN_MAX, and MM_ALIGN of a value that is
+ * not a power of two, make mm_mallocx fail.
+ */
+#define MM_LG_ALIGN_MAX  30
+#define MM_LG_ALIGN(la)  ((int)(la) & 0x3f)
+#define MM_ALIGN(a)      MM_LG_ALIGN((unsigned long)(a) == 0 ? 0 : \
+    ((unsigned long)(a) & ((unsigned long)(a) - 1)) ? 0x3f : \
+    __builtin_ctzl((unsigned long)(a)))
+#define MM_ARENA(n)      (((int)(n) & 0xf) << 16)
+#define MM_ZERO          0x0100  /* zero the payload */
+#define MM_NOCACHE       0x0200  /* bypass caching and sampling layers */
+#define MM_REALLOCED     0x0400  /* expected to grow through mm_realloc */
+#define MM_LONGLIVED     0x0800  /* expected to outlive most blocks */
+#define MM_COMPRESSIBLE  0x1000  /* stay within reach of mm_compress */
+#define MM_NOSHARE       0x2000  /* share no cache line with another block */
+
+extern void *mm_mallocx(size_t size, int flags);
+
+/* Lifetime-aware placement of short-lived blocks. */
+extern void mm_set_lifetime_mode(int on);
+extern void *mm_malloc_hint(size_t size, uintptr_t hint);
+
+/* Give repeatedly grown blocks geometric headroom (on by default). */
+extern void mm_set_realloc_headroom(int on);
+
+/*
+ * Relocatable blocks.  A handle points at the block's current payload
+ * address; lock the handle before dereferencing it and unlock it when done
+ * so that mm_compact can move the block.  Handle blocks must not be passed
+ * to mm_free or mm_realloc.
+ */
+typedef void **mm_handle_t;
+
+extern mm_handle_t mm_halloc(size_t size);
+extern void *mm_hlock(mm_handle_t handle);
+extern void mm_hunlock(mm_handle_t handle);
+extern void mm_hfree(mm_handle_t handle);
+extern size_t mm_compact(void);
+
+/* Merge free runs and rebuild the free list in address order. */
+extern size_t mm_defrag_index(void);
+
+/*
+ * Heap walking.  Each block is described by its payload address, its size
+ * including header and footer, whether it is allocated, and its arena.
+ */
+struct mm_block_info {
+    void *addr;
+    size_t size;
+    int alloc;
+    int arena;
+};
+
+typedef int (*mm_walk_fn)(const struct mm_block_info *blk, void *ctx);
+
+#define MM_WALK_FREE      0x1   /* walk the free list instead of the heap */
+#define MM_WALK_SNAPSHOT  0x2   /* walk a copy; the callback may allocate */
+
+extern int mm_heap_walk(mm_walk_fn fn, void *ctx, int flags);
+extern int mm_heap_walk_parallel(mm_walk_fn fn, void *ctx, int nthreads);
+extern void mm_checkheap(int verbose);
+
+/* Report allocated blocks that are unreachable from the roots. */
+extern long mm_leak_check(int verbose);
+
+/* Serve power-of-two sizes in [lo, hi] from a buddy allocator. */
+extern int mm_set_buddy_range(size_t lo, size_t hi);
+
+/* Serve large requests as page spans; purge free spans. */
+extern void mm_set_span_threshold(size_t bytes);
+extern size_t mm_span_purge(void);
+
+/* Serve the largest requests from retained mappings; unmap old ones. */
+extern void mm_set_extents(size_t threshold, size_t retain);
+extern size_t mm_extent_purge(unsigned ms);
+
+/* Serve small requests from meshable pages; fold sparse pages together. */
+extern void mm_set_mesh(int on);
+extern size_t mm_mesh(void);
+
+/* Serve medium requests from spans with out-of-band metadata. */
+extern void mm_set_oob(size_t max);
+
+/* Give every block cache lines of its own. */
+extern void mm_set_noshare(int on);
+
+/* Extend the heap ahead of demand from a background thread. */
+extern int mm_set_grow_ahead(unsigned ms);
+
+/* Build a fixed, locked heap with bounded-time malloc and free. */
+extern void mm_set_realtime(size_t bytes);
+
+/* Delay reuse of freed blocks and release them in sorted batches. */
+extern void mm_set_quarantine(size_t n);
+extern void mm_flush_quarantine(void);
+
+/* Free blocks once no reader in an epoch section can still hold them. */
+extern int mm_epoch_enter(void);
+extern void mm_epoch_exit(void);
+extern void mm_free_deferred(void *bp);
+
+/* Free blocks in batches on a background reclaimer thread. */
+extern void mm_free_async(void *bp);
+extern void mm_free_async_flush(void);
+
+/* Budget the arenas; purge free memory. */
+typedef void (*mm_pressure_fn)(int arena, size_t used, size_t soft,
+    void *ctx);
+
+extern int mm_set_arena_budget(int arena, size_t soft, size_t hard,
+    mm_pressure_fn fn, void *ctx);
+extern size_t mm_arena_usage(int arena);
+extern size_t mm_purge(void);
+
+/* React to system memory pressure. */
+#define MM_PRESSURE_NONE      0
+#define MM_PRESSURE_LOW       1
+#define MM_PRESSURE_HIGH      2
+#define MM_PRESSURE_CRITICAL  3
+
+struct mm_pressure_sample {
+    double some_avg10;      /* % of time some task stalled on memory */
+    size_t limit;           /* cgroup memory limit, 0 if none */
+    size_t current;         /* cgroup memory usage */
+};
+
+typedef int (*mm_pressure_src)(struct mm_pressure_sample *ps, void *ctx);
+
+extern void mm_set_pressure_source(mm_pressure_src fn, void *ctx);
+extern int mm_pressure_poll(void);
+extern int mm_pressure_monitor(unsigned ms);
+
+/* Counters kept by the allocator since mm_init. */
+struct mm_stats {
+    size_t realloc_inplace;     /* mm_realloc calls grown in place */
+    size_t realloc_copies;      /* mm_realloc calls that moved the block */
+    size_t mesh_released;       /* physical pages released by mm_mesh */
+    size_t heap_grown;          /* bytes the heap was extended by */
+    size_t heap_grown_ahead;    /* of which ahead of demand */
+    size_t extent_hits;         /* large blocks served by retained extents */
+    size_t extent_misses;       /* large blocks that needed a new mapping */
+};
+
+extern void mm_get_stats(struct mm_stats *st);
+
+/*
+ * Compressed references.  A block in the heap reservation is named by a
+ * 32-bit count of words from its start, so pointer-heavy structures that
+ * live in the heap can store half-size links.  0 stands for NULL, and a
+ * reference stays valid until the next mm_init.  Blocks allocated with
+ * MM_COMPRESSIBLE, and any block moved from such a block by mm_realloc,
+ * can always be compressed; other blocks only if mm_compressible says so.
+ */
+#define MM_COMPRESS_SHIFT  3
+
+extern char *mm_compress_base;
+extern int mm_compressible(const void *p);
+
+static inline uint32_t mm_compress(const void *p)
+{
+    return p == NULL ? 0 :
+        (uint32_t)(((const char *)p - mm_compress_base) >> MM_COMPRESS_SHIFT);
+}
+
+static inline void *mm_decompress(uint32_t ref)
+{
+    return ref == 0 ? NULL :
+        mm_compress_base + ((size_t)ref << MM_COMPRESS_SHIFT);
+}
+
+#ifdef __cplusplus
+}
+
+namespace mm {
+
+/* A pointer to a T in the heap, stored as a compressed reference. */
+template <class T>
+class compressed_ptr {
+public:
+    compressed_ptr() : ref_(0) {}
+    compressed_ptr(T *p) : ref_(mm_compress(p)) {}
+
+    T *get() const { return static_cast<T *>(mm_decompress(ref_)); }
+    T &operator*() const { return *get(); }
+    T *operator->() const { return get(); }
+    operator T *() const { return get(); }
+    explicit operator bool() const { return ref_ != 0; }
+    uint32_t ref() const { return ref_; }
+
+    bool operator==(compressed_ptr o) const { return ref_ == o.ref_; }
+    bool operator!=(compressed_ptr o) const { return ref_ != o.ref_; }
+
+private:
+    uint32_t ref_;
+};
+
+} /* namespace mm */
+#endif
+
+#endif /* MMX_H */